@@ -0,0 +1,245 @@
+/*
+ * allocstats.c
+ *
+ * Allocation counters for the -DALLOC_STATS instrumentation build.
+ * The malloc family is interposed (glibc only, via the __libc_*
+ * entry points), so allocations made by the resolver libraries are
+ * counted as well as our own. OpenSSL allocations are additionally
+ * tracked through CRYPTO_set_mem_functions(), to show their share.
+ * Sizes are taken from malloc_usable_size(), so that frees can be
+ * accounted without a header on each block.
+ */
+
+#ifdef ALLOC_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <openssl/crypto.h>
+
+#include "allocstats.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+const char *alloc_phase_names[ALLOC_NPHASES] = {
+    "startup", "dns", "tls", "cleanup"
+};
+
+typedef struct alloc_counters {
+    size_t allocs;			/* number of allocations */
+    size_t bytes;			/* bytes allocated */
+    size_t crypto_allocs;		/* of which made by OpenSSL */
+    size_t crypto_bytes;
+    size_t peak;			/* peak live heap during phase */
+} alloc_counters;
+
+static alloc_counters counters[ALLOC_NPHASES];
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+static int current_phase = ALLOC_PHASE_STARTUP;
+
+/*
+ * The unbound backend resolves in a separate thread, so counters
+ * are updated atomically.
+ */
+
+static void update_peak(size_t *peak, size_t value)
+{
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (value > old &&
+	   !__atomic_compare_exchange_n(peak, &old, value, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    return;
+}
+
+static void account_alloc(void *ptr)
+{
+    alloc_counters *c = &counters[current_phase];
+    size_t size, live;
+
+    if (ptr == NULL)
+	return;
+    size = malloc_usable_size(ptr);
+    __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->bytes, size, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+    update_peak(&c->peak, live);
+    update_peak(&peak_bytes, live);
+    return;
+}
+
+static void account_free(void *ptr)
+{
+    if (ptr != NULL)
+	__atomic_sub_fetch(&live_bytes, malloc_usable_size(ptr),
+			   __ATOMIC_RELAXED);
+    return;
+}
+
+static void account_crypto(void *ptr)
+{
+    alloc_counters *c = &counters[current_phase];
+
+    if (ptr == NULL)
+	return;
+    __atomic_add_fetch(&c->crypto_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->crypto_bytes, malloc_usable_size(ptr),
+		       __ATOMIC_RELAXED);
+    return;
+}
+
+
+/*
+ * Interposed malloc family.
+ */
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newptr;
+    size_t oldsize = ptr ? malloc_usable_size(ptr) : 0;
+
+    if ((newptr = __libc_realloc(ptr, size)) == NULL) {
+	/* realloc(ptr, 0) frees ptr; on other failures ptr is kept */
+	if (ptr != NULL && size == 0)
+	    __atomic_sub_fetch(&live_bytes, oldsize, __ATOMIC_RELAXED);
+	return NULL;
+    }
+    __atomic_sub_fetch(&live_bytes, oldsize, __ATOMIC_RELAXED);
+    account_alloc(newptr);
+    return newptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr = memalign(alignment, size);
+
+    if (ptr == NULL)
+	return 12; /* ENOMEM */
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr)
+{
+    account_free(ptr);
+    __libc_free(ptr);
+}
+
+
+/*
+ * OpenSSL memory functions: allocate through the interposed functions
+ * above, and count the OpenSSL share separately.
+ */
+
+static void *crypto_malloc(size_t size, const char *file, int line)
+{
+    void *ptr = malloc(size);
+    (void) file; (void) line;
+    account_crypto(ptr);
+    return ptr;
+}
+
+static void *crypto_realloc(void *ptr, size_t size, const char *file, int line)
+{
+    void *newptr = realloc(ptr, size);
+    (void) file; (void) line;
+    account_crypto(newptr);
+    return newptr;
+}
+
+static void crypto_free(void *ptr, const char *file, int line)
+{
+    (void) file; (void) line;
+    free(ptr);
+}
+
+
+/*
+ * alloc_stats_init(): install the OpenSSL memory functions. Must be
+ * called before anything else is done with OpenSSL.
+ */
+
+void alloc_stats_init(void)
+{
+    if (!CRYPTO_set_mem_functions(crypto_malloc, crypto_realloc, crypto_free))
+	fprintf(stderr, "alloc stats: cannot hook OpenSSL allocations\n");
+    return;
+}
+
+
+/*
+ * alloc_stats_phase(): attribute subsequent allocations to phase.
+ * The peak of the new phase starts from the current live heap.
+ */
+
+void alloc_stats_phase(enum ALLOC_PHASE phase)
+{
+    current_phase = phase;
+    update_peak(&counters[phase].peak,
+		__atomic_load_n(&live_bytes, __ATOMIC_RELAXED));
+    return;
+}
+
+
+/*
+ * alloc_stats_report(): print allocation counts, bytes and peak live
+ * heap per phase, and the overall peak for this target, on stderr.
+ */
+
+void alloc_stats_report(const char *hostname)
+{
+    alloc_counters c[ALLOC_NPHASES];
+    size_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    int i;
+
+    /* snapshot first: the output below allocates */
+    for (i = 0; i < ALLOC_NPHASES; i++)
+	c[i] = counters[i];
+
+    fprintf(stderr, "Allocations for %s:\n", hostname);
+    fprintf(stderr, "  %-8s %8s %10s %8s %10s %10s\n", "phase",
+	    "allocs", "bytes", "openssl", "ossl-bytes", "peak");
+    for (i = 0; i < ALLOC_NPHASES; i++)
+	fprintf(stderr, "  %-8s %8zu %10zu %8zu %10zu %10zu\n",
+		alloc_phase_names[i], c[i].allocs, c[i].bytes,
+		c[i].crypto_allocs, c[i].crypto_bytes, c[i].peak);
+    fprintf(stderr, "  Peak heap: %zu bytes, still allocated: %zu bytes\n",
+	    peak, live);
+    return;
+}
+
+#endif /* ALLOC_STATS */
@@ -0,0 +1,28 @@
+#ifndef __ALLOCSTATS_H__
+#define __ALLOCSTATS_H__
+
+/*
+ * Allocation statistics, compiled in only when built with
+ * -DALLOC_STATS. Allocations are attributed to the pipeline phase
+ * that is current when they are made.
+ */
+
+enum ALLOC_PHASE {
+    ALLOC_PHASE_STARTUP=0,
+    ALLOC_PHASE_DNS,
+    ALLOC_PHASE_TLS,
+    ALLOC_PHASE_CLEANUP,
+    ALLOC_NPHASES
+};
+
+#ifdef ALLOC_STATS
+void alloc_stats_init(void);
+void alloc_stats_phase(enum ALLOC_PHASE phase);
+void alloc_stats_report(const char *hostname);
+#else
+#define alloc_stats_init()		do { } while (0)
+#define alloc_stats_phase(phase)	do { } while (0)
+#define alloc_stats_report(hostname)	do { } while (0)
+#endif
+
+#endif /* __ALLOCSTATS_H__ */
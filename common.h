@@ -9,6 +9,29 @@ enum AUTH_MODE {
     MODE_PKIX
 };
 
+/*
+ * Values for long options that take an argument
+ */
+
+enum LONG_OPTION {
+    OPT_POSTFIX_POLICY=256,
+    OPT_POSTFIX_DEFAULT,
+    OPT_RESULTS,
+    OPT_PEER_NAME,
+    OPT_SAMPLE,
+    OPT_SEED,
+    OPT_STATE,
+    OPT_BREAKER_THRESHOLD,
+    OPT_BREAKER_COOLDOWN,
+    OPT_LOAD,
+    OPT_LOAD_CONCURRENCY,
+    OPT_LOAD_RATE,
+    OPT_TRACE_FILE,
+    OPT_TRACE_SAMPLE,
+    OPT_TOP,
+    OPT_POLICY_NEXTHOP
+};
+
 extern int debug;
 extern int attempt_dane;
 extern enum AUTH_MODE auth_mode;
@@ -16,5 +39,26 @@ extern char *CAfile;
 extern char *service_name;
 extern int dane_ee_check_name;
 extern int smtp_any_mode;
+extern char *postfix_policy_file;
+extern char *postfix_policy_default;
+extern char *postfix_policy_nexthop;
+extern char *results_file;
+extern int timeout;
+extern int address_family;
+extern int one_per_family;
+extern int sample_count;
+extern unsigned int sample_seed;
+extern char *state_file;
+extern int breaker_threshold;
+extern int breaker_cooldown;
+extern int load_duration;
+extern int load_concurrency;
+extern int load_rate;
+extern char *trace_file;
+extern int diff_mode;
+extern int monitor_mode;
+extern int report_mode;
+extern int report_top;
+extern double trace_sample;
 
 #endif /* __COMMON_H__ */
@@ -0,0 +1,470 @@
+/*
+ * Program to test DANE TLS services.
+ * Requires OpenSSL 1.1.1 or later.
+ *
+ * This version uses libunbound to query and validate the DNS records.
+ *
+ * Author: Shumon Huque <shuque@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "common.h"
+#include "utils.h"
+#include "tls.h"
+#include "query-unbound.h"
+#include "starttls.h"
+#include "results.h"
+#include "state.h"
+#include "loadgen.h"
+#include "allocstats.h"
+#include "tracefile.h"
+#include "diffresults.h"
+#include "monitor.h"
+#include "policy.h"
+#include "report.h"
+
+
+/*
+ * Global variables
+ */
+
+int debug = 0;
+int attempt_dane = 0;
+int recursion = 0;
+char *trust_anchor_file = "/var/lib/unbound/root.key";
+enum AUTH_MODE auth_mode = MODE_BOTH;
+char *CAfile = NULL;
+char *service_name = NULL;
+int dane_ee_check_name = 0;
+int smtp_any_mode = 0;
+char *postfix_policy_file = NULL;
+char *postfix_policy_default = "may";
+char *postfix_policy_nexthop = NULL;
+char *results_file = NULL;
+int timeout = 0;
+int address_family = AF_UNSPEC;
+int one_per_family = 0;
+int sample_count = 0;
+unsigned int sample_seed = 1;
+char *state_file = NULL;
+int breaker_threshold = 3;
+int breaker_cooldown = 86400;
+int load_duration = 0;
+int load_concurrency = 1;
+int load_rate = 0;
+char *trace_file = NULL;
+double trace_sample = 1.0;
+int diff_mode = 0;
+int monitor_mode = 0;
+int report_mode = 0;
+int report_top = 100;
+
+/*
+ * usage(): Print usage string and exit.
+ */
+
+void print_usage(const char *progname)
+{
+    fprintf(stdout, "\n%s version %s\n"
+	    "\nUsage: %s [options] <hostname> <portnumber>\n"
+	    "       %s --diff <old-results> <new-results>\n"
+	    "       %s --report [--top <n>] <results>\n\n"
+	    "       -h:                    print this help message\n"
+	    "       -d:                    debug mode\n"
+	    "       -r:                    use full recursion mode\n"
+	    "                              (default is to forward queries to the\n"
+	    "                              resolvers in /etc/resolv.conf)\n"
+	    "       -a <file>:             DNSSEC trust anchor file\n"
+	    "                              (default /var/lib/unbound/root.key)\n"
+	    "       -n <name>:             service name\n"
+	    "       -4:                    check IPv4 addresses only\n"
+	    "       -6:                    check IPv6 addresses only\n"
+	    "       -c <cafile>:           CA file\n"
+	    "       -t <seconds>:          connect and I/O timeout per peer\n"
+	    "                              (default: none, use system defaults)\n"
+	    "       -m <dane|pkix>:        dane or pkix mode\n"
+	    "                              (default is dane & fallback to pkix)\n"
+	    "       -s <app>:              use starttls with specified application\n"
+	    "                              (smtp, imap, pop3, xmpp-client, xmpp-server)\n"
+	    "       --dane-ee-check-name:  perform name checks for DANE-EE mode\n"
+	    "       --smtp-any-mode:       allow any usage mode for SMTP\n"
+	    "                              (normally only modes 2 or 3 are allowed)\n"
+	    "       --postfix-policy <file>:\n"
+	    "                              write Postfix TLS policy entry to file,\n"
+	    "                              with the weakest level of the next-hop's\n"
+	    "                              hosts, if all peers could be checked\n"
+	    "                              (dane-only if DANE authentication succeeded\n"
+	    "                              for all peers, verify if PKIX did)\n"
+	    "       --postfix-default <level>:\n"
+	    "                              policy level otherwise (default: may)\n"
+	    "       --policy-nexthop <domain>:\n"
+	    "                              key the policy entry by next-hop domain,\n"
+	    "                              e.g. the recipient domain of an MX host\n"
+	    "                              (default: [host]:port, for a relayhost)\n"
+	    "       --results <file>:      append structured per peer results to file\n"
+	    "       --peer-name <name>:    also accept name in the peer certificate\n"
+	    "                              (may be repeated, e.g. for the next-hop\n"
+	    "                              domain of an SMTP MX host, RFC 7672)\n"
+	    "       --one-per-family:      check only the first address of each family\n"
+	    "       --sample <n>:          check a random sample of n addresses\n"
+	    "       --seed <n>:            random seed for --sample (default 1)\n"
+	    "       --state <file>:        state file kept across runs\n"
+	    "       --breaker-threshold <n>:\n"
+	    "                              with --state, skip an address after n\n"
+	    "                              consecutive connect failures (default 3,\n"
+	    "                              0 disables)\n"
+	    "       --breaker-cooldown <seconds>:\n"
+	    "                              how long to keep skipping it after the\n"
+	    "                              last failure (default 86400)\n"
+	    "       --load <seconds>:      load test: repeat STARTTLS and TLS\n"
+	    "                              handshakes with the first address for\n"
+	    "                              this long, and report the rate achieved\n"
+	    "       --load-concurrency <n>: number of parallel workers (default 1)\n"
+	    "       --load-rate <n>:       limit to n handshakes per second\n"
+	    "       --trace-file <file>:   append a timeline of the check to file\n"
+	    "                              (Chrome trace event format)\n"
+	    "       --trace-sample <f>:    trace only a fraction f of runs\n"
+	    "                              (default 1.0)\n"
+	    "       --monitor:             with --state, print only changes to\n"
+	    "                              the verdicts of the target's peers\n"
+	    "                              (exit status 4 if anything changed)\n"
+	    "\n",
+	    progname, PROGRAM_VERSION, progname, progname, progname);
+    exit(3);
+}
+
+
+/*
+ * parse_options()
+ */
+
+int parse_options(const char *progname, int argc, char **argv)
+{
+    int c;
+    int longindex = 0;
+
+    static struct option long_options[] = {
+	{ "dane-ee-check-name", no_argument, &dane_ee_check_name, 1 },
+	{ "smtp-any-mode", no_argument, &smtp_any_mode, 1 },
+	{ "postfix-policy", required_argument, NULL, OPT_POSTFIX_POLICY },
+	{ "postfix-default", required_argument, NULL, OPT_POSTFIX_DEFAULT },
+	{ "policy-nexthop", required_argument, NULL, OPT_POLICY_NEXTHOP },
+	{ "results", required_argument, NULL, OPT_RESULTS },
+	{ "peer-name", required_argument, NULL, OPT_PEER_NAME },
+	{ "one-per-family", no_argument, &one_per_family, 1 },
+	{ "sample", required_argument, NULL, OPT_SAMPLE },
+	{ "seed", required_argument, NULL, OPT_SEED },
+	{ "state", required_argument, NULL, OPT_STATE },
+	{ "breaker-threshold", required_argument, NULL, OPT_BREAKER_THRESHOLD },
+	{ "breaker-cooldown", required_argument, NULL, OPT_BREAKER_COOLDOWN },
+	{ "load", required_argument, NULL, OPT_LOAD },
+	{ "load-concurrency", required_argument, NULL, OPT_LOAD_CONCURRENCY },
+	{ "load-rate", required_argument, NULL, OPT_LOAD_RATE },
+	{ "trace-file", required_argument, NULL, OPT_TRACE_FILE },
+	{ "trace-sample", required_argument, NULL, OPT_TRACE_SAMPLE },
+	{ "diff", no_argument, &diff_mode, 1 },
+	{ "monitor", no_argument, &monitor_mode, 1 },
+	{ "report", no_argument, &report_mode, 1 },
+	{ "top", required_argument, NULL, OPT_TOP },
+	{ 0, 0, 0, 0 }
+    };
+
+    while ((c = getopt_long(argc, argv, "hd46ra:n:c:t:m:s:",
+			    long_options, &longindex)) != -1) {
+        switch(c) {
+	case 0: break;
+	case OPT_POSTFIX_POLICY:
+	    postfix_policy_file = optarg; break;
+	case OPT_POSTFIX_DEFAULT:
+	    postfix_policy_default = optarg; break;
+	case OPT_POLICY_NEXTHOP:
+	    postfix_policy_nexthop = optarg; break;
+	case OPT_RESULTS:
+	    results_file = optarg; break;
+	case OPT_PEER_NAME:
+	    if (!add_reference_name(optarg))
+		print_usage(progname);
+	    break;
+	case OPT_SAMPLE:
+	    sample_count = atoi(optarg); break;
+	case OPT_SEED:
+	    sample_seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+	case OPT_STATE:
+	    state_file = optarg; break;
+	case OPT_BREAKER_THRESHOLD:
+	    breaker_threshold = atoi(optarg); break;
+	case OPT_BREAKER_COOLDOWN:
+	    breaker_cooldown = atoi(optarg); break;
+	case OPT_LOAD:
+	    load_duration = atoi(optarg); break;
+	case OPT_LOAD_CONCURRENCY:
+	    load_concurrency = atoi(optarg); break;
+	case OPT_LOAD_RATE:
+	    load_rate = atoi(optarg); break;
+	case OPT_TRACE_FILE:
+	    trace_file = optarg; break;
+	case OPT_TRACE_SAMPLE:
+	    trace_sample = atof(optarg); break;
+	case OPT_TOP:
+	    if ((report_top = atoi(optarg)) <= 0)
+		print_usage(progname);
+	    break;
+        case 'h': print_usage(progname); break;
+        case 'd': debug = 1; break;
+        case '4': address_family = AF_INET; break;
+        case '6': address_family = AF_INET6; break;
+        case 'r': recursion = 1; break;
+	case 'a':
+	    trust_anchor_file = optarg; break;
+	case 'n':
+	    service_name = optarg; break;
+	case 'c':
+	    CAfile = optarg; break;
+	case 't':
+	    timeout = atoi(optarg); break;
+        case 'm': 
+	    if (strcmp(optarg, "dane") == 0)
+		auth_mode = MODE_DANE;
+	    else if (strcmp(optarg, "pkix") == 0)
+		auth_mode = MODE_PKIX;
+	    else
+		print_usage(progname);
+	    break;
+	case 's': 
+	    if (strcmp(optarg, "smtp") == 0)
+	        starttls = STARTTLS_SMTP;
+	    else if (strcmp(optarg, "imap") == 0)
+		starttls = STARTTLS_IMAP;
+	    else if (strcmp(optarg, "pop3") == 0)
+		starttls = STARTTLS_POP3;
+	    else if (strcmp(optarg, "xmpp-client") == 0)
+		starttls = STARTTLS_XMPP_CLIENT;
+	    else if (strcmp(optarg, "xmpp-server") == 0)
+		starttls = STARTTLS_XMPP_SERVER;
+	    else {
+		fprintf(stdout, "Unsupported STARTTLS application: %s.\n",
+			optarg);
+		print_usage(progname);
+	    }
+	    break;
+        default:
+            print_usage(progname);
+        }
+    }
+
+    /* a load test gives no per peer verdicts to record */
+    if (load_duration > 0 && (postfix_policy_file || monitor_mode)) {
+	fprintf(stdout, "--load cannot be used with --postfix-policy or "
+		"--monitor.\n");
+	print_usage(progname);
+    }
+    return optind;
+}
+
+
+/*
+ * main(): DANE TLSA test program.
+ */
+
+int main(int argc, char **argv)
+{
+
+    int rc = 2; /* default AUTH FAILED */
+    const char *progname, *hostname;
+    uint16_t port;
+    int optcount;
+
+    SSL_CTX *ctx = NULL;
+
+    alloc_stats_init();
+
+    if ((progname = strrchr(argv[0], '/')))
+        progname++;
+    else
+        progname = argv[0];
+
+    optcount = parse_options(progname, argc, argv);
+    argc -= optcount;
+    argv += optcount;
+
+    /*
+     * Report timings and failures over a results file.
+     */
+
+    if (report_mode && argc == 1)
+	return report_results(argv[0]);
+
+    if (argc != 2) print_usage(progname);
+
+    /*
+     * Compare two results files instead of checking a server.
+     */
+
+    if (diff_mode)
+	return diff_results(argv[0], argv[1]);
+
+    hostname = argv[0];
+    port = atoi(argv[1]);
+
+    /*
+     * Load the state kept across runs; in monitoring mode, report
+     * only changes to the stored verdicts.
+     */
+
+    if (state_file && !state_load(state_file))
+	goto cleanup;
+
+    if (monitor_mode && !monitor_start())
+	goto cleanup;
+
+    if (postfix_policy_file && !policy_start())
+	goto cleanup;
+
+    /*
+     * Trace file for this check (not in load test mode, where the
+     * workers would interleave their events).
+     */
+
+    if (trace_file && load_duration == 0 &&
+	!trace_open(trace_file, hostname, trace_sample))
+	goto cleanup;
+
+    alloc_stats_phase(ALLOC_PHASE_DNS);
+
+    /*
+     * Obtain and validate address and TLSA records with libunbound
+     */
+
+    if (do_dns_queries(hostname, port) != 1) {
+	fprintf(stdout, "DNS query dispatch failed.\n");
+	goto cleanup;
+    }
+
+    /*
+     * Bail out if responses are bogus or indeterminate, or if no
+     * addresses are found.
+     */
+
+    if (dns_bogus_or_indeterminate) {
+	fprintf(stdout, "DNSSEC status of responses is bogus or indeterminate.\n");
+        goto cleanup;
+    }
+
+    if (addresses == NULL) {
+	fprintf(stdout, "No address records found, exiting.\n");
+	goto cleanup;
+    }
+
+    /*
+     * Apply the address selection policy (family, one per family,
+     * random sample), reporting any addresses that are skipped.
+     */
+
+    addresses = select_addresses(addresses);
+    if (addresses == NULL) {
+	fprintf(stdout, "No addresses selected, exiting.\n");
+	goto cleanup;
+    }
+
+    /*
+     * Set flag to attempt DANE ("attempt_dane") only if TLSA
+     * records were found and both address and TLSA record set
+     * were successfully authenticated with DNSSEC.
+     */
+
+    if (auth_mode == MODE_DANE || auth_mode == MODE_BOTH) {
+        if (tlsa_rdata_list == NULL) {
+	    fprintf(stdout, "No TLSA records found.\n");
+            if (auth_mode == MODE_DANE)
+                goto cleanup;
+        } else if (tlsa_authenticated == 0) {
+            fprintf(stdout, "Insecure TLSA records.\n");
+            if (auth_mode == MODE_DANE)
+                goto cleanup;
+        } else if (v4_authenticated == 0 || v6_authenticated == 0) {
+            fprintf(stdout, "Insecure Address records.\n");
+            if (auth_mode == MODE_DANE)
+                goto cleanup;
+        } else {
+            attempt_dane = 1;
+        }
+    }
+
+    /*
+     * If the TLSA records in use are those at the CNAME-expanded name,
+     * that name is the TLSA base domain: it is sent as SNI and is the
+     * primary reference identifier, while the original name remains
+     * acceptable (RFC 7671, Section 7). The original name is still
+     * used for the STARTTLS conversation and in the results.
+     */
+
+    if (attempt_dane && tlsa_base_domain) {
+	if (debug)
+	    fprintf(stdout, "TLSA base domain: %s\n", tlsa_base_domain);
+	(void) add_reference_name(hostname);
+	tls_base_name = tlsa_base_domain;
+    }
+
+    /*
+     * Print TLSA records if debug flag was provided.
+     */
+
+    if (debug && attempt_dane) {
+	print_tlsa(tlsa_rdata_list);
+    }
+
+    /*
+     * In load test mode, repeat handshakes with the first address
+     * instead of checking each address once.
+     */
+
+    alloc_stats_phase(ALLOC_PHASE_TLS);
+
+    if (load_duration > 0) {
+	rc = do_load(hostname, addresses, tlsa_rdata_list);
+	goto cleanup;
+    }
+
+    /*
+     * establish TLS sessions to server addresses
+     */
+
+    if (results_file && !open_results(results_file))
+	goto cleanup;
+
+    rc = do_tls(hostname, addresses, tlsa_rdata_list);
+    close_results();
+
+ cleanup:
+    alloc_stats_phase(ALLOC_PHASE_CLEANUP);
+    trace_close();
+    if (postfix_policy_file)
+	(void) write_postfix_policy(hostname, port);
+    if (monitor_mode)
+	rc = monitor_finish(hostname, port, rc);
+    if (state_file)
+	(void) state_save(state_file);
+    freeaddrinfo(addresses);
+    free_tlsa(tlsa_rdata_list);
+    if (ctx)
+	SSL_CTX_free(ctx);
+
+    alloc_stats_report(hostname);
+    return rc;
+}
@@ -0,0 +1,433 @@
+/*
+ * diffresults.c
+ *
+ * Diff two results files, e.g. from yesterday's and today's sweep.
+ * Records are joined on (host, port, address) with a hash table. When
+ * the inputs together are larger than DIFF_MEMORY, both are first
+ * split into that many partitions by hash of the key, in temporary
+ * files, and the partitions are joined one at a time (a grace hash
+ * join), so that memory use stays bounded however large the sweep.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+
+#include "diffresults.h"
+#include "results.h"
+
+#define DIFF_MEMORY	(64 * 1024 * 1024)
+#define MAX_KEY		512
+#define MAX_FIELD	256
+
+typedef struct diff_entry {
+    char *key;
+    char *old_line;
+    char *new_line;
+    uint32_t hash;
+    struct diff_entry *next;
+} diff_entry;
+
+typedef struct diff_table {
+    diff_entry **buckets;
+    size_t nbuckets;
+    size_t count;
+} diff_table;
+
+static struct {
+    size_t added, removed, changed;
+    size_t tlsa_mismatch, lost_dane, gained_dane, tlsa_change;
+    size_t verdict_change, tls_downgrade, cipher_change, cert_change;
+} diff_counts;
+
+
+/*
+ * hash_key(): FNV-1a hash of a key.
+ */
+
+uint32_t hash_key(const char *key)
+{
+    uint32_t h = 2166136261U;
+
+    for (; *key; key++) {
+	h ^= (unsigned char) *key;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+
+/*
+ * make_key(): join key of a results line: "host port address".
+ */
+
+int make_key(const char *line, char *key, size_t size)
+{
+    char host[MAX_FIELD], port[MAX_FIELD], address[MAX_FIELD];
+
+    if (!get_result_field(line, "host", host, sizeof(host)) ||
+	!get_result_field(line, "port", port, sizeof(port)) ||
+	!get_result_field(line, "address", address, sizeof(address)))
+	return 0;
+    snprintf(key, size, "%s %s %s", host, port, address);
+    return 1;
+}
+
+
+/*
+ * table_add(): store line as the old or new record for key. If a key
+ * occurs more than once in a file, the last record is used.
+ */
+
+void table_add(diff_table *t, const char *key, uint32_t hash,
+	       char *line, int is_new)
+{
+    diff_entry *ep, **epp, *next;
+    size_t i, nbuckets;
+
+    for (ep = t->buckets[hash % t->nbuckets]; ep != NULL; ep = ep->next) {
+	if (ep->hash == hash && strcmp(ep->key, key) == 0)
+	    break;
+    }
+
+    if (ep == NULL) {
+	if (t->count >= 2 * t->nbuckets) {
+	    nbuckets = 2 * t->nbuckets;
+	    epp = (diff_entry **) calloc(nbuckets, sizeof(diff_entry *));
+	    for (i = 0; i < t->nbuckets; i++) {
+		for (ep = t->buckets[i]; ep != NULL; ep = next) {
+		    next = ep->next;
+		    ep->next = epp[ep->hash % nbuckets];
+		    epp[ep->hash % nbuckets] = ep;
+		}
+	    }
+	    free(t->buckets);
+	    t->buckets = epp;
+	    t->nbuckets = nbuckets;
+	}
+	ep = (diff_entry *) calloc(1, sizeof(diff_entry));
+	ep->key = strdup(key);
+	ep->hash = hash;
+	ep->next = t->buckets[hash % t->nbuckets];
+	t->buckets[hash % t->nbuckets] = ep;
+	t->count++;
+    }
+
+    if (is_new) {
+	free(ep->new_line);
+	ep->new_line = line;
+    } else {
+	free(ep->old_line);
+	ep->old_line = line;
+    }
+    return;
+}
+
+
+/*
+ * load_records(): add every record in fp to the table.
+ */
+
+void load_records(diff_table *t, FILE *fp, int is_new)
+{
+    char *line = NULL, key[MAX_KEY];
+    size_t size = 0;
+
+    while (getline(&line, &size, fp) != -1) {
+	if (!make_key(line, key, sizeof(key)))
+	    continue;
+	table_add(t, key, hash_key(key), line, is_new);
+	line = NULL;
+	size = 0;
+    }
+    free(line);
+    return;
+}
+
+
+/*
+ * tls_rank(): order connections by strength, for detecting downgrades:
+ * by protocol version, then forward secrecy of the cipher suite.
+ */
+
+int tls_rank(const char *version, const char *cipher)
+{
+    int rank = 0;
+
+    if (strcmp(version, "TLSv1.3") == 0)
+	rank = 8;
+    else if (strcmp(version, "TLSv1.2") == 0)
+	rank = 6;
+    else if (strcmp(version, "TLSv1.1") == 0)
+	rank = 4;
+    else if (strcmp(version, "TLSv1") == 0)
+	rank = 2;
+
+    if (strncmp(cipher, "TLS_", 4) == 0 || strstr(cipher, "DHE"))
+	rank++;
+    return rank;
+}
+
+
+/*
+ * compare_records(): report what changed between the old and new
+ * record of one peer, if anything.
+ */
+
+void compare_records(const char *key, const char *old, const char *new)
+{
+    char ostatus[MAX_FIELD], nstatus[MAX_FIELD], oerror[MAX_FIELD],
+	nerror[MAX_FIELD], odane[MAX_FIELD], ndane[MAX_FIELD],
+	otlsa[MAX_FIELD], ntlsa[MAX_FIELD], oversion[MAX_FIELD],
+	nversion[MAX_FIELD], ocipher[MAX_FIELD], ncipher[MAX_FIELD],
+	ocert[MAX_FIELD], ncert[MAX_FIELD];
+    char changes[4 * MAX_FIELD];
+    size_t len = 0;
+    int ook, nok, mismatch = 0;
+
+    (void) get_result_field(old, "status", ostatus, MAX_FIELD);
+    (void) get_result_field(new, "status", nstatus, MAX_FIELD);
+    (void) get_result_field(old, "error", oerror, MAX_FIELD);
+    (void) get_result_field(new, "error", nerror, MAX_FIELD);
+    (void) get_result_field(old, "dane", odane, MAX_FIELD);
+    (void) get_result_field(new, "dane", ndane, MAX_FIELD);
+    (void) get_result_field(old, "tlsa", otlsa, MAX_FIELD);
+    (void) get_result_field(new, "tlsa", ntlsa, MAX_FIELD);
+    (void) get_result_field(old, "version", oversion, MAX_FIELD);
+    (void) get_result_field(new, "version", nversion, MAX_FIELD);
+    (void) get_result_field(old, "cipher", ocipher, MAX_FIELD);
+    (void) get_result_field(new, "cipher", ncipher, MAX_FIELD);
+    (void) get_result_field(old, "cert", ocert, MAX_FIELD);
+    (void) get_result_field(new, "cert", ncert, MAX_FIELD);
+
+    /* a peer skipped by the circuit breaker was not checked */
+    if (strcmp(oerror, "skipped-breaker-open") == 0 ||
+	strcmp(nerror, "skipped-breaker-open") == 0)
+	return;
+
+    ook = (strcmp(ostatus, "ok") == 0);
+    nok = (strcmp(nstatus, "ok") == 0);
+    changes[0] = '\0';
+
+#define ADD_CHANGE(...) \
+    len += snprintf(changes + len, (len < sizeof(changes)) ? \
+		    sizeof(changes) - len : 0, __VA_ARGS__)
+
+    /*
+     * Each kind of change is checked on its own, so that e.g. a peer
+     * that now fails with a different certificate reports both.
+     */
+
+    if (ook && !nok) {
+	if (strcmp(odane, "-") != 0 &&
+	    (strcmp(nerror, "verify") == 0 ||
+	     strcmp(nerror, "no-usable-tlsa") == 0)) {
+	    ADD_CHANGE(" tlsa-mismatch (%s)", nerror);
+	    diff_counts.tlsa_mismatch++;
+	    mismatch = 1;
+	} else {
+	    ADD_CHANGE(" verdict ok -> fail (%s)", nerror);
+	    diff_counts.verdict_change++;
+	}
+    } else if (!ook && nok) {
+	ADD_CHANGE(" verdict fail (%s) -> ok", oerror);
+	diff_counts.verdict_change++;
+    } else if (!ook && !nok && strcmp(oerror, nerror) != 0) {
+	ADD_CHANGE(" verdict fail (%s) -> fail (%s)", oerror, nerror);
+	diff_counts.verdict_change++;
+    }
+
+    /*
+     * A version or cert of "-": no handshake or certificate to compare.
+     * Without a handshake the dane field is "-" too, so DANE is only
+     * compared between completed handshakes; a peer that lost DANE by
+     * failing is already reported as tlsa-mismatch.
+     */
+
+    if (strcmp(oversion, "-") != 0 && strcmp(nversion, "-") != 0) {
+	if (strcmp(odane, "-") != 0 && strcmp(ndane, "-") == 0) {
+	    if (!mismatch) {
+		ADD_CHANGE(" lost-dane (%s)", odane);
+		diff_counts.lost_dane++;
+	    }
+	} else if (strcmp(odane, "-") == 0 && strcmp(ndane, "-") != 0) {
+	    ADD_CHANGE(" gained-dane (%s)", ndane);
+	    diff_counts.gained_dane++;
+	} else if (strcmp(odane, ndane) != 0 || strcmp(otlsa, ntlsa) != 0) {
+	    ADD_CHANGE(" tlsa-change (%s -> %s)", odane, ndane);
+	    diff_counts.tlsa_change++;
+	}
+	if (tls_rank(nversion, ncipher) < tls_rank(oversion, ocipher)) {
+	    ADD_CHANGE(" tls-downgrade (%s %s -> %s %s)",
+		       oversion, ocipher, nversion, ncipher);
+	    diff_counts.tls_downgrade++;
+	} else if (strcmp(ocipher, ncipher) != 0) {
+	    ADD_CHANGE(" cipher-change (%s -> %s)", ocipher, ncipher);
+	    diff_counts.cipher_change++;
+	}
+    }
+    if (strcmp(ocert, "-") != 0 && strcmp(ncert, "-") != 0 &&
+	strcmp(ocert, ncert) != 0) {
+	ADD_CHANGE(" cert-change");
+	diff_counts.cert_change++;
+    }
+
+#undef ADD_CHANGE
+
+    if (changes[0]) {
+	fprintf(stdout, "changed %s:%s\n", key, changes);
+	diff_counts.changed++;
+    }
+    return;
+}
+
+
+/*
+ * diff_partition(): join the old and new records of one partition,
+ * report differences, and free the table.
+ */
+
+void diff_partition(FILE *old_fp, FILE *new_fp)
+{
+    diff_table table;
+    diff_entry *ep, *next;
+    char status[MAX_FIELD];
+    size_t i;
+
+    table.nbuckets = 1024;
+    table.count = 0;
+    table.buckets = (diff_entry **) calloc(table.nbuckets, sizeof(diff_entry *));
+
+    load_records(&table, old_fp, 0);
+    load_records(&table, new_fp, 1);
+
+    for (i = 0; i < table.nbuckets; i++) {
+	for (ep = table.buckets[i]; ep != NULL; ep = next) {
+	    next = ep->next;
+	    if (ep->old_line == NULL) {
+		(void) get_result_field(ep->new_line, "status", status, MAX_FIELD);
+		fprintf(stdout, "added %s: %s\n", ep->key, status);
+		diff_counts.added++;
+	    } else if (ep->new_line == NULL) {
+		(void) get_result_field(ep->old_line, "status", status, MAX_FIELD);
+		fprintf(stdout, "removed %s: %s\n", ep->key, status);
+		diff_counts.removed++;
+	    } else
+		compare_records(ep->key, ep->old_line, ep->new_line);
+	    free(ep->key);
+	    free(ep->old_line);
+	    free(ep->new_line);
+	    free(ep);
+	}
+    }
+    free(table.buckets);
+    return;
+}
+
+
+/*
+ * partition_records(): split the records in fp by hash of their key
+ * into nparts temporary files. Returns NULL on failure.
+ */
+
+FILE **partition_records(FILE *fp, size_t nparts)
+{
+    FILE **parts;
+    char *line = NULL, key[MAX_KEY];
+    size_t i, size = 0;
+
+    parts = (FILE **) calloc(nparts, sizeof(FILE *));
+    for (i = 0; i < nparts; i++) {
+	if ((parts[i] = tmpfile()) == NULL) {
+	    fprintf(stdout, "Unable to create temporary file.\n");
+	    while (i > 0)
+		fclose(parts[--i]);
+	    free(parts);
+	    return NULL;
+	}
+    }
+
+    while (getline(&line, &size, fp) != -1) {
+	if (make_key(line, key, sizeof(key)))
+	    fputs(line, parts[hash_key(key) % nparts]);
+    }
+    free(line);
+
+    for (i = 0; i < nparts; i++)
+	rewind(parts[i]);
+    return parts;
+}
+
+
+/*
+ * diff_results(): report added, removed and changed peers between
+ * two results files, and a summary. Returns 0 if there were no
+ * differences, 1 if there were, and 2 on error.
+ */
+
+int diff_results(const char *old_path, const char *new_path)
+{
+    FILE *old_fp, *new_fp, **old_parts = NULL, **new_parts = NULL;
+    struct stat old_st, new_st;
+    size_t i, nparts = 0;
+    int rc = 2;
+
+    if ((old_fp = fopen(old_path, "r")) == NULL) {
+	fprintf(stdout, "Unable to open results file %s.\n", old_path);
+	return rc;
+    }
+    if ((new_fp = fopen(new_path, "r")) == NULL) {
+	fprintf(stdout, "Unable to open results file %s.\n", new_path);
+	fclose(old_fp);
+	return rc;
+    }
+
+    if (fstat(fileno(old_fp), &old_st) == -1 ||
+	fstat(fileno(new_fp), &new_st) == -1)
+	goto cleanup;
+    nparts = (old_st.st_size + new_st.st_size) / DIFF_MEMORY + 1;
+
+    if (nparts == 1)
+	diff_partition(old_fp, new_fp);
+    else {
+	if ((old_parts = partition_records(old_fp, nparts)) == NULL ||
+	    (new_parts = partition_records(new_fp, nparts)) == NULL)
+	    goto cleanup;
+	for (i = 0; i < nparts; i++) {
+	    diff_partition(old_parts[i], new_parts[i]);
+	    fclose(old_parts[i]);
+	    fclose(new_parts[i]);
+	}
+    }
+
+    fprintf(stdout, "Summary: %zu added, %zu removed, %zu changed",
+	    diff_counts.added, diff_counts.removed, diff_counts.changed);
+    if (diff_counts.changed)
+	fprintf(stdout, " (tlsa-mismatch %zu, lost-dane %zu, gained-dane %zu,"
+		" tlsa-change %zu, verdict %zu, tls-downgrade %zu,"
+		" cipher-change %zu, cert-change %zu)",
+		diff_counts.tlsa_mismatch, diff_counts.lost_dane,
+		diff_counts.gained_dane, diff_counts.tlsa_change,
+		diff_counts.verdict_change, diff_counts.tls_downgrade,
+		diff_counts.cipher_change, diff_counts.cert_change);
+    fprintf(stdout, "\n");
+
+    rc = (diff_counts.added || diff_counts.removed || diff_counts.changed);
+
+cleanup:
+    if (old_parts && new_parts == NULL) {
+	for (i = 0; i < nparts; i++)
+	    fclose(old_parts[i]);
+    }
+    free(old_parts);
+    free(new_parts);
+    fclose(old_fp);
+    fclose(new_fp);
+    return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef __DIFFRESULTS_H__
+#define __DIFFRESULTS_H__
+
+/*
+ * Compare two results files (as written with --results) and report
+ * the peers that were added, removed, or whose verdict changed.
+ */
+
+int diff_results(const char *old_path, const char *new_path);
+
+#endif /* __DIFFRESULTS_H__ */
@@ -0,0 +1,308 @@
+/*
+ * loadgen.c
+ *
+ * Load generation mode: measure how many STARTTLS + TLS handshakes per
+ * second a server sustains. Each of load_concurrency worker processes
+ * repeatedly connects to the peer, performs the STARTTLS conversation
+ * (if any) and the TLS handshake with peer authentication, and reports
+ * the outcome and latency of each attempt to the parent over a pipe.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "common.h"
+#include "starttls.h"
+#include "tls.h"
+#include "loadgen.h"
+#include "utils.h"
+#include "sketch.h"
+
+/*
+ * Outcome of one handshake attempt: success, or the stage that failed.
+ */
+
+enum LOAD_STAGE {
+    LOAD_OK=0,
+    LOAD_SOCKET,
+    LOAD_CONNECT,
+    LOAD_SETUP,
+    LOAD_NO_USABLE_TLSA,
+    LOAD_STARTTLS,
+    LOAD_HANDSHAKE,
+    LOAD_VERIFY,
+    LOAD_NSTAGES
+};
+
+const char *load_stage_names[LOAD_NSTAGES] = {
+    "ok", "socket", "connect", "setup", "no-usable-tlsa", "starttls",
+    "handshake", "verify"
+};
+
+typedef struct load_record {
+    uint32_t usec;
+    uint32_t stage;
+} load_record;
+
+
+/*
+ * handshake_once(): one connection, STARTTLS conversation and TLS
+ * handshake, set up the same way as in do_tls(): the same reference
+ * identifiers, and no handshake in DANE mode without a usable TLSA
+ * record.
+ */
+
+enum LOAD_STAGE handshake_once(SSL_CTX *ctx, const char *hostname,
+			       struct addrinfo *address,
+			       tlsa_rdata *tlsa_rdata_list)
+{
+    enum LOAD_STAGE stage = LOAD_OK;
+    SSL *ssl = NULL;
+    BIO *sbio;
+    tlsa_rdata *rp;
+    int sock, tlsa_usable = 0;
+
+    if ((sock = socket(address->ai_family, SOCK_STREAM, IPPROTO_TCP)) == -1)
+	return LOAD_SOCKET;
+
+    if (connect_timeout(sock, address->ai_addr, address->ai_addrlen,
+			timeout) == -1) {
+	close(sock);
+	return LOAD_CONNECT;
+    }
+
+    if ((ssl = SSL_new(ctx)) == NULL) {
+	close(sock);
+	return LOAD_SETUP;
+    }
+
+    if (attempt_dane) {
+	if (SSL_dane_enable(ssl, tls_peer_name(hostname)) <= 0) {
+	    stage = LOAD_SETUP;
+	    goto cleanup;
+	}
+	for (rp = tlsa_rdata_list; rp != NULL; rp = rp->next) {
+	    if (SSL_dane_tlsa_add(ssl, rp->usage, rp->selector, rp->mtype,
+				  rp->data, rp->data_len) > 0)
+		tlsa_usable++;
+	}
+    } else {
+	if (SSL_set1_host(ssl, tls_peer_name(hostname)) != 1) {
+	    stage = LOAD_SETUP;
+	    goto cleanup;
+	}
+	(void) SSL_set_tlsext_host_name(ssl, tls_peer_name(hostname));
+    }
+    (void) add_reference_names(ssl);
+    SSL_set_hostflags(ssl, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+
+    if (auth_mode == MODE_DANE && tlsa_usable == 0) {
+	stage = LOAD_NO_USABLE_TLSA;
+	goto cleanup;
+    }
+
+    SSL_set_connect_state(ssl);
+    sbio = BIO_new_socket(sock, BIO_NOCLOSE);
+    SSL_set_bio(ssl, sbio, sbio);
+    (void) SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
+
+    if (starttls != STARTTLS_NONE &&
+	!do_starttls(starttls, sbio, service_name, hostname)) {
+	stage = LOAD_STARTTLS;
+	goto cleanup;
+    }
+
+    if (SSL_connect(ssl) <= 0) {
+	stage = LOAD_HANDSHAKE;
+	goto cleanup;
+    }
+
+    if (SSL_get_verify_result(ssl) != X509_V_OK)
+	stage = LOAD_VERIFY;
+
+    SSL_shutdown(ssl);
+
+cleanup:
+    ERR_clear_error();
+    SSL_free(ssl);
+    close(sock);
+    return stage;
+}
+
+
+/*
+ * load_worker(): run handshakes until the deadline, writing a record
+ * for each to fd. If load_rate is set, attempts are paced so that the
+ * workers together start load_rate handshakes per second.
+ */
+
+void load_worker(int fd, SSL_CTX *ctx, const char *hostname,
+		 struct addrinfo *address, tlsa_rdata *tlsa_rdata_list,
+		 uint64_t deadline)
+{
+    load_record rec;
+    uint64_t start, next = now_usec(), interval = 0;
+
+    if (load_rate > 0)
+	interval = (uint64_t) load_concurrency * 1000000 / load_rate;
+
+    while ((start = now_usec()) < deadline) {
+	if (interval) {
+	    if (start < next) {
+		usleep(next - start);
+		continue;
+	    }
+	    next += interval;
+	}
+	rec.stage = handshake_once(ctx, hostname, address, tlsa_rdata_list);
+	rec.usec = (uint32_t) (now_usec() - start);
+	if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+	    break;
+    }
+    return;
+}
+
+
+/*
+ * do_load(): run the load test against the given peer address and
+ * print a report. Returns 0 if any handshake succeeded, 2 otherwise.
+ */
+
+int do_load(const char *hostname, struct addrinfo *address,
+	    tlsa_rdata *tlsa_rdata_list)
+{
+    SSL_CTX *ctx;
+    struct pollfd *pfds;
+    pid_t *pids;
+    load_record rec;
+    sketch latencies;
+    size_t count = 0, total = 0;
+    size_t errors[LOAD_NSTAGES];
+    uint64_t start, deadline, elapsed;
+    int i, open_fds, fds[2];
+    char ipstring[INET6_ADDRSTRLEN];
+    ssize_t n;
+
+    if (load_concurrency < 1)
+	load_concurrency = 1;
+    memset(errors, 0, sizeof(errors));
+    sketch_init(&latencies);
+
+    if (address->ai_family == AF_INET6)
+	inet_ntop(AF_INET6, &((struct sockaddr_in6 *) address->ai_addr)->sin6_addr,
+		  ipstring, sizeof(ipstring));
+    else
+	inet_ntop(AF_INET, &((struct sockaddr_in *) address->ai_addr)->sin_addr,
+		  ipstring, sizeof(ipstring));
+    fprintf(stdout, "Load test: %s (%s) for %d seconds, %d workers",
+	    hostname, ipstring, load_duration, load_concurrency);
+    if (load_rate > 0)
+	fprintf(stdout, ", %d handshakes/s", load_rate);
+    fprintf(stdout, "\n");
+    fflush(stdout);
+
+    if ((ctx = new_tls_context()) == NULL)
+	return 2;
+
+    signal(SIGPIPE, SIG_IGN);
+    pfds = (struct pollfd *) calloc(load_concurrency, sizeof(struct pollfd));
+    pids = (pid_t *) calloc(load_concurrency, sizeof(pid_t));
+    start = now_usec();
+    deadline = start + (uint64_t) load_duration * 1000000;
+
+    for (i = 0; i < load_concurrency; i++)
+	pfds[i].fd = -1;
+
+    for (i = 0; i < load_concurrency; i++) {
+	if (pipe(fds) == -1) {
+	    fprintf(stdout, "pipe failed: %s\n", strerror(errno));
+	    break;
+	}
+	if ((pids[i] = fork()) == -1) {
+	    fprintf(stdout, "fork failed: %s\n", strerror(errno));
+	    close(fds[0]);
+	    close(fds[1]);
+	    break;
+	} else if (pids[i] == 0) {
+	    close(fds[0]);
+	    load_worker(fds[1], ctx, hostname, address, tlsa_rdata_list,
+			deadline);
+	    _exit(0);
+	}
+	close(fds[1]);
+	pfds[i].fd = fds[0];
+	pfds[i].events = POLLIN;
+    }
+    open_fds = i;
+
+    /* Collect records until all workers have closed their pipes */
+    while (open_fds > 0) {
+	if (poll(pfds, load_concurrency, -1) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	for (i = 0; i < load_concurrency; i++) {
+	    if (pfds[i].fd == -1 || pfds[i].revents == 0)
+		continue;
+	    n = read(pfds[i].fd, &rec, sizeof(rec));
+	    if (n != sizeof(rec)) {
+		close(pfds[i].fd);
+		pfds[i].fd = -1;
+		open_fds--;
+		continue;
+	    }
+	    total++;
+	    if (rec.stage != LOAD_OK) {
+		errors[rec.stage < LOAD_NSTAGES ? rec.stage : LOAD_SETUP]++;
+		continue;
+	    }
+	    count++;
+	    sketch_add(&latencies, rec.usec);
+	}
+    }
+    for (i = 0; i < load_concurrency; i++) {
+	if (pids[i] > 0)
+	    (void) waitpid(pids[i], NULL, 0);
+    }
+    elapsed = now_usec() - start;
+
+    /* Report */
+    fprintf(stdout, "Handshakes: %zu succeeded of %zu in %.1fs (%.1f/s)\n",
+	    count, total, elapsed / 1e6, count / (elapsed / 1e6));
+    if (count > 0)
+	fprintf(stdout, "Latency (ms): p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+		sketch_quantile(&latencies, 0.50) / 1000.0,
+		sketch_quantile(&latencies, 0.90) / 1000.0,
+		sketch_quantile(&latencies, 0.99) / 1000.0,
+		latencies.max / 1000.0);
+    if (total > count) {
+	fprintf(stdout, "Errors:");
+	for (i = 1; i < LOAD_NSTAGES; i++) {
+	    if (errors[i])
+		fprintf(stdout, " %s %zu", load_stage_names[i], errors[i]);
+	}
+	fprintf(stdout, "\n");
+    }
+
+    free(pfds);
+    free(pids);
+    SSL_CTX_free(ctx);
+    return (count > 0) ? 0 : 2;
+}
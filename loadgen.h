@@ -0,0 +1,15 @@
+#ifndef __LOADGEN_H__
+#define __LOADGEN_H__
+
+#include "tlsardata.h"
+
+/*
+ * Load generation: repeat the STARTTLS and TLS handshake against one
+ * peer for a fixed duration and report the achieved rate, latency
+ * percentiles and errors.
+ */
+
+int do_load(const char *hostname, struct addrinfo *address,
+	    tlsa_rdata *tlsa_rdata_list);
+
+#endif /* __LOADGEN_H__ */
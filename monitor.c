@@ -0,0 +1,242 @@
+/*
+ * monitor.c
+ *
+ * Monitoring mode (--monitor). The normal report is suppressed; the
+ * verdict of every peer address is collected from do_tls(), and the
+ * verdicts of the target are compared with those stored in the state
+ * file by the previous run. Only peers whose verdict, error class,
+ * matched TLSA record or certificate changed are printed.
+ *
+ * The state holds one compact entry per target:
+ *   verdict <host> <port>	<address> <status> <error> <dane> <tlsa> <cert>;...
+ * with the TLSA data and certificate fingerprint abbreviated. Peers
+ * that the circuit breaker skipped keep their stored entry.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+
+#include "common.h"
+#include "monitor.h"
+#include "state.h"
+#include "utils.h"
+
+#define MAX_KEY		512
+#define MAX_PEERS	32
+#define PEER_MAX	160
+#define TLSA_PREFIX	8	/* bytes of TLSA data kept */
+#define CERT_PREFIX	16	/* hex digits of fingerprint kept */
+
+static FILE *monitor_fp = NULL;
+static char peers[MAX_PEERS][PEER_MAX];
+static int peer_count = 0;
+static char skipped[MAX_PEERS][INET6_ADDRSTRLEN];
+static int skipped_count = 0;
+
+
+/*
+ * monitor_start(): send the normal report to /dev/null, keeping the
+ * original standard output for change notifications, and collect the
+ * per peer results. Returns 0 on failure.
+ */
+
+int monitor_start(void)
+{
+    int fd;
+
+    if (state_file == NULL) {
+	fprintf(stderr, "--monitor requires --state.\n");
+	return 0;
+    }
+
+    fflush(stdout);
+    if ((fd = dup(STDOUT_FILENO)) == -1 ||
+	(monitor_fp = fdopen(fd, "w")) == NULL ||
+	freopen("/dev/null", "w", stdout) == NULL) {
+	fprintf(stderr, "Unable to redirect output for monitoring.\n");
+	return 0;
+    }
+
+    (void) add_tls_result_callback(monitor_result, NULL);
+    return 1;
+}
+
+
+/*
+ * monitor_result(): result callback; record the verdict of one peer
+ * as "<address> <status> <error> <dane> <tlsa> <cert>". A peer skipped
+ * by the circuit breaker was not checked, so it has no new verdict.
+ */
+
+void monitor_result(tls_result *result, void *userarg)
+{
+    char dane[16] = "-", *tlsa_hex = NULL;
+
+    (void) userarg;
+    if (result->error && strcmp(result->error, "skipped-breaker-open") == 0) {
+	if (skipped_count < MAX_PEERS)
+	    snprintf(skipped[skipped_count++], INET6_ADDRSTRLEN, "%s",
+		     result->address);
+	return;
+    }
+    if (peer_count >= MAX_PEERS)
+	return;
+
+    if (result->dane_depth >= 0 && result->tlsa_data != NULL) {
+	snprintf(dane, sizeof(dane), "%d,%d,%d",
+		 result->usage, result->selector, result->mtype);
+	tlsa_hex = bin2hexstring((uint8_t *) result->tlsa_data,
+				 (result->tlsa_data_len > TLSA_PREFIX) ?
+				 TLSA_PREFIX : result->tlsa_data_len);
+    }
+
+    snprintf(peers[peer_count++], PEER_MAX, "%s %s %s %s %s %.*s",
+	     result->address, result->authenticated ? "ok" : "fail",
+	     result->error ? result->error : "-", dane,
+	     tlsa_hex ? tlsa_hex : "-", CERT_PREFIX,
+	     result->cert_sha256[0] ? result->cert_sha256 : "-");
+    free(tlsa_hex);
+    return;
+}
+
+
+/*
+ * find_peer(): find the entry for address in a ';' separated list of
+ * peer verdicts, and copy it to buf. Returns 0 if not found.
+ */
+
+int find_peer(const char *list, const char *address, char *buf, size_t size)
+{
+    const char *cp = list, *end;
+    size_t addrlen = strlen(address), len;
+
+    while (cp && *cp) {
+	end = strchr(cp, ';');
+	len = end ? (size_t) (end - cp) : strlen(cp);
+	if (len > addrlen && strncmp(cp, address, addrlen) == 0 &&
+	    cp[addrlen] == ' ') {
+	    if (len >= size)
+		len = size - 1;
+	    memcpy(buf, cp, len);
+	    buf[len] = '\0';
+	    return 1;
+	}
+	cp = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+
+/*
+ * print_changes(): print the peers whose entries differ between the
+ * lists a (old) and b (new), in b's order, or only in a if reverse.
+ */
+
+int print_changes(const char *hostname, uint16_t port,
+		  const char *a, const char *b, int reverse)
+{
+    const char *cp = b, *end;
+    char entry[PEER_MAX], address[PEER_MAX], old[PEER_MAX];
+    size_t len;
+    int changes = 0;
+
+    while (cp && *cp) {
+	end = strchr(cp, ';');
+	len = end ? (size_t) (end - cp) : strlen(cp);
+	if (len >= sizeof(entry))
+	    len = sizeof(entry) - 1;
+	memcpy(entry, cp, len);
+	entry[len] = '\0';
+	cp = end ? end + 1 : NULL;
+
+	len = strcspn(entry, " ");
+	memcpy(address, entry, len);
+	address[len] = '\0';
+
+	if (!find_peer(a, address, old, sizeof(old))) {
+	    fprintf(monitor_fp, "%s %s %d %s\n", reverse ? "removed" : "new",
+		    hostname, port, entry);
+	    changes++;
+	} else if (!reverse && strcmp(old, entry) != 0) {
+	    fprintf(monitor_fp, "changed %s %d %s -> %s\n",
+		    hostname, port, old, entry + len + 1);
+	    changes++;
+	}
+    }
+    return changes;
+}
+
+
+/*
+ * compare_peers(): qsort comparison, so that the stored list does not
+ * depend on the order of the address records.
+ */
+
+int compare_peers(const void *a, const void *b)
+{
+    return strcmp((const char *) a, (const char *) b);
+}
+
+
+/*
+ * monitor_finish(): compare this run's verdicts for the target with
+ * the stored ones, print the differences, and store the new ones.
+ * Peers skipped by the circuit breaker keep their stored entry, and
+ * are not compared. If no peer was checked or skipped (e.g. DNS
+ * lookups failed), the target gets a single "-" entry with error
+ * class "not-checked". Returns EXIT_CHANGED if anything changed,
+ * otherwise rc.
+ */
+
+int monitor_finish(const char *hostname, uint16_t port, int rc)
+{
+    char key[MAX_KEY], *list;
+    const char *old;
+    size_t len = 0;
+    int i, changes = 0;
+
+    if (monitor_fp == NULL)
+	return rc;
+    remove_tls_result_callback(monitor_result);
+
+    snprintf(key, sizeof(key), "verdict %s %d", hostname, port);
+    old = state_get(key);
+    for (i = 0; i < skipped_count && peer_count < MAX_PEERS; i++) {
+	if (old && find_peer(old, skipped[i], peers[peer_count], PEER_MAX))
+	    peer_count++;
+    }
+
+    if (peer_count == 0 && skipped_count == 0)
+	snprintf(peers[peer_count++], PEER_MAX, "- fail not-checked - - -");
+    if (peer_count == 0) {
+	/* only peers skipped, with no stored verdict: nothing to compare */
+	fclose(monitor_fp);
+	monitor_fp = NULL;
+	return rc;
+    }
+    qsort(peers, peer_count, PEER_MAX, compare_peers);
+
+    list = (char *) malloc(peer_count * PEER_MAX);
+    list[0] = '\0';
+    for (i = 0; i < peer_count; i++)
+	len += snprintf(list + len, peer_count * PEER_MAX - len, "%s%s",
+			i ? ";" : "", peers[i]);
+
+    if (old == NULL || strcmp(old, list) != 0) {
+	changes += print_changes(hostname, port, old ? old : "", list, 0);
+	changes += print_changes(hostname, port, list, old ? old : "", 1);
+	state_set(key, list);
+    }
+    free(list);
+
+    fclose(monitor_fp);
+    monitor_fp = NULL;
+    return changes ? EXIT_CHANGED : rc;
+}
@@ -0,0 +1,19 @@
+#ifndef __MONITOR_H__
+#define __MONITOR_H__
+
+#include <stdint.h>
+
+#include "tls.h"
+
+/*
+ * Monitoring mode: the verdict for each peer of a target is kept in
+ * the state file, and output is produced only when it changes.
+ */
+
+#define EXIT_CHANGED 4
+
+int monitor_start(void);
+void monitor_result(tls_result *result, void *userarg);
+int monitor_finish(const char *hostname, uint16_t port, int rc);
+
+#endif /* __MONITOR_H__ */
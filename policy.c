@@ -0,0 +1,195 @@
+/*
+ * policy.c
+ *
+ * Postfix TLS policy table (--postfix-policy). The verdicts of the
+ * peers of the target are collected from do_tls(), and the policy
+ * level for the next-hop is written to the table file. This program
+ * does not run postmap: the file has to be compiled with postmap
+ * before Postfix can use it in smtp_tls_policy_maps.
+ *
+ * The next-hop is postfix_policy_nexthop (for MX delivery, the
+ * recipient domain) or else [hostname]:port, the form used for an
+ * explicit relayhost. A domain usually has several MX hosts, each
+ * checked by a separate run, so the level of every host is kept in a
+ * comment line above the entry:
+ *   # danetls <nexthop> [<host>]:<port> <level>
+ * and the entry for the next-hop gets the weakest level of its hosts.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+
+#include "common.h"
+#include "policy.h"
+
+#define MAX_NAME	512
+#define MAX_HOSTS	64
+#define RECORD_TAG	"# danetls "
+
+static int peers_ok = 0, peers_dane = 0, peers_failed = 0,
+    peers_unchecked = 0;
+
+
+/*
+ * policy_start(): collect the per peer results.
+ */
+
+int policy_start(void)
+{
+    return add_tls_result_callback(policy_result, NULL);
+}
+
+
+/*
+ * policy_result(): result callback; count the peers authenticated
+ * (and how many of them with DANE), those that failed, and those
+ * that could not be checked: skipped by the circuit breaker, or not
+ * reached, which says nothing about their TLS service.
+ */
+
+void policy_result(tls_result *result, void *userarg)
+{
+    (void) userarg;
+
+    if (result->error == NULL) {
+	peers_ok++;
+	if (result->dane_depth >= 0)
+	    peers_dane++;
+    } else if (strcmp(result->error, "skipped-breaker-open") == 0 ||
+	       strcmp(result->error, "socket") == 0 ||
+	       strcmp(result->error, "connect") == 0 ||
+	       strcmp(result->error, "ssl-new") == 0) {
+	peers_unchecked++;
+    } else {
+	peers_failed++;
+    }
+    return;
+}
+
+
+/*
+ * level_rank(): order policy levels by strength; all levels other
+ * than dane-only and verify are the (weaker) default level.
+ */
+
+int level_rank(const char *level)
+{
+    if (strcmp(level, "dane-only") == 0)
+	return 2;
+    if (strcmp(level, "verify") == 0)
+	return 1;
+    return 0;
+}
+
+
+/*
+ * write_postfix_policy(): record the level of this host for the
+ * next-hop in the table file, and set the entry of the next-hop to
+ * the weakest level of its hosts. Nothing is written unless every
+ * peer of the host was checked: a DNS failure, a skipped or
+ * unreachable peer must not change (or downgrade) the policy.
+ * The file is rewritten under an exclusive lock on <file>.lock, via
+ * a temporary file which then replaces the old one. Returns 0 on
+ * failure.
+ */
+
+int write_postfix_policy(const char *hostname, uint16_t port)
+{
+    FILE *fp, *tmpfp;
+    char nexthop[MAX_NAME], host[MAX_NAME], tmppath[MAX_NAME + 8],
+	lockpath[MAX_NAME + 8], rec_nexthop[MAX_NAME], rec_host[MAX_NAME],
+	rec_level[MAX_NAME], weakest[MAX_NAME], *line = NULL;
+    char records[MAX_HOSTS][3 * MAX_NAME];
+    const char *level;
+    size_t size = 0, keylen;
+    int i, nrecords = 0, lockfd, rc = 0;
+
+    remove_tls_result_callback(policy_result);
+    if (peers_unchecked > 0 || peers_ok + peers_failed == 0) {
+	if (debug)
+	    fprintf(stdout, "Postfix policy not updated: no verdict for "
+		    "all peers.\n");
+	return 1;
+    }
+    if (peers_failed > 0)
+	level = postfix_policy_default;
+    else if (peers_dane == peers_ok)
+	level = "dane-only";
+    else
+	level = "verify";
+
+    snprintf(host, sizeof(host), "[%s]:%d", hostname, port);
+    snprintf(nexthop, sizeof(nexthop), "%s",
+	     postfix_policy_nexthop ? postfix_policy_nexthop : host);
+    keylen = strlen(nexthop);
+
+    snprintf(lockpath, sizeof(lockpath), "%s.lock", postfix_policy_file);
+    if ((lockfd = open(lockpath, O_RDWR | O_CREAT, 0644)) == -1 ||
+	flock(lockfd, LOCK_EX) == -1) {
+	fprintf(stderr, "Unable to lock Postfix policy file %s.\n", lockpath);
+	if (lockfd != -1)
+	    close(lockfd);
+	return 0;
+    }
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", postfix_policy_file);
+    if ((tmpfp = fopen(tmppath, "w")) == NULL) {
+	fprintf(stderr, "Unable to write Postfix policy file %s.\n", tmppath);
+	goto cleanup;
+    }
+
+    /*
+     * Copy all lines but the entry and host records of the next-hop,
+     * keeping the records of the other hosts.
+     */
+
+    if ((fp = fopen(postfix_policy_file, "r")) != NULL) {
+	while (getline(&line, &size, fp) != -1) {
+	    if (strncmp(line, RECORD_TAG, strlen(RECORD_TAG)) == 0 &&
+		sscanf(line + strlen(RECORD_TAG), "%511s %511s %511s",
+		       rec_nexthop, rec_host, rec_level) == 3 &&
+		strcasecmp(rec_nexthop, nexthop) == 0) {
+		if (strcasecmp(rec_host, host) != 0 && nrecords < MAX_HOSTS)
+		    snprintf(records[nrecords++], sizeof(records[0]),
+			     "%s %s", rec_host, rec_level);
+		continue;
+	    }
+	    if (strncasecmp(line, nexthop, keylen) == 0 &&
+		(line[keylen] == ' ' || line[keylen] == '\t'))
+		continue;
+	    fputs(line, tmpfp);
+	}
+	free(line);
+	fclose(fp);
+    }
+
+    snprintf(weakest, sizeof(weakest), "%s", level);
+    for (i = 0; i < nrecords; i++) {
+	fprintf(tmpfp, "%s%s %s\n", RECORD_TAG, nexthop, records[i]);
+	if (sscanf(records[i], "%*s %511s", rec_level) == 1 &&
+	    level_rank(rec_level) < level_rank(weakest))
+	    snprintf(weakest, sizeof(weakest), "%s", rec_level);
+    }
+    fprintf(tmpfp, "%s%s %s %s\n", RECORD_TAG, nexthop, host, level);
+    fprintf(tmpfp, "%s\t%s\n", nexthop, weakest);
+
+    if (fclose(tmpfp) != 0 || rename(tmppath, postfix_policy_file) != 0) {
+	fprintf(stderr, "Unable to write Postfix policy file %s.\n",
+		postfix_policy_file);
+	goto cleanup;
+    }
+    rc = 1;
+
+cleanup:
+    close(lockfd);
+    return rc;
+}
@@ -0,0 +1,18 @@
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stdint.h>
+
+#include "tls.h"
+
+/*
+ * Postfix TLS policy table: the policy level for the next-hop is
+ * derived from the verdicts of all its hosts, and only from checks
+ * that reached every peer.
+ */
+
+int policy_start(void);
+void policy_result(tls_result *result, void *userarg);
+int write_postfix_policy(const char *hostname, uint16_t port);
+
+#endif /* __POLICY_H__ */
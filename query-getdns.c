@@ -28,6 +28,7 @@
 #endif
 
 #include "query-getdns.h"
+#include "trace.h"
 #include "utils.h"
 #include "common.h"
 #include "starttls.h"
@@ -124,9 +125,40 @@ struct addrinfo *make_addrinfo(getdns_dict *address,
 size_t tlsa_count = 0;
 tlsa_rdata *tlsa_rdata_list = NULL;
 
+/*
+ * TLSA records at the CNAME-expanded name of the host (RFC 7671),
+ * kept apart until one of the two candidate sets is selected.
+ */
+
+char *tlsa_base_domain = NULL;
+char *cname_target = NULL;
+char cname_domainstring[512];
+size_t cname_tlsa_count = 0;
+int cname_tlsa_authenticated = 0;
+tlsa_rdata *cname_tlsa_rdata_list = NULL;
+
+/*
+ * Context and extensions of the current do_dns_queries() call, for
+ * queries that are issued from callbacks.
+ */
+
+getdns_context *dns_context = NULL;
+getdns_dict *dns_extensions = NULL;
+
 #define UNUSED_PARAM(x) ((void) (x))
 
 
+/*
+ * bindata2hexstring(): convert a getdns bindata input into a string of
+ * hex digits. Caller needs to free returned memory.
+ */
+
+char *bindata2hexstring(getdns_bindata *b)
+{
+    return bin2hexstring(b->data, b->size);
+}
+
+
 /*
  * all_responses_secure()
  */
@@ -188,38 +220,168 @@ int all_responses_secure(getdns_dict *response)
 
 
 /*
- * callback function for address lookups
+ * cb_query(): getdns callback for all queries. Passes the response
+ * to the handler of the query, and destroys it afterwards. The
+ * handler gets a NULL response if the query did not complete.
  */
 
-void cb_address(getdns_context *ctx,
-		getdns_callback_type_t cb_type,
-		getdns_dict *response, 
-		void *userarg,
-		getdns_transaction_t tid)
+void cb_query(getdns_context *ctx,
+	      getdns_callback_type_t cb_type,
+	      getdns_dict *response,
+	      void *userarg,
+	      getdns_transaction_t tid)
 {
     UNUSED_PARAM(ctx);
-    getdns_return_t rc;
-    uint32_t status=0;
     qinfo *qip = (qinfo *) userarg;
-    const char *hostname = qip->qname;
-    uint16_t port = qip->port;
-    getdns_list    *just_addresses;
-    size_t         cnt_addr;
-    getdns_dict    *address;
+    const char *qtype_name =
+	(qip->qtype == GETDNS_RRTYPE_TLSA) ? "TLSA" : "address";
+    getdns_dict *answer = NULL;
 
     switch (cb_type) {
     case GETDNS_CALLBACK_COMPLETE:
+	answer = response;
 	break;
     case GETDNS_CALLBACK_TIMEOUT:
-	fprintf(stderr, "Callback: address query timed out: %s\n", hostname);
-	return;
+	fprintf(stderr, "Callback: %s query timed out: %s\n",
+		qtype_name, qip->qname);
+	break;
     case GETDNS_CALLBACK_CANCEL:
     case GETDNS_CALLBACK_ERROR:
     default:
-	fprintf(stderr, "Callback address fail: %s, tid=%"PRIu64" rc=%d\n",
-		hostname, tid, cb_type);
+	fprintf(stderr, "Callback %s fail: %s, tid=%"PRIu64" rc=%d\n",
+		qtype_name, qip->qname, tid, cb_type);
+	break;
+    }
+
+    TRACE3(dns_complete, qip->qname, qip->qtype, answer != NULL);
+    qip->handler((void *) answer, (void *) qip);
+
+    if (response)
+	getdns_dict_destroy(response);
+    return;
+}
+
+
+/*
+ * submit_query()
+ * Dispatch the query described by qip. handler is called with the
+ * response and qip once the answer arrives. Address lookups (A and
+ * AAAA) use qtype GETDNS_RRTYPE_A.
+ */
+
+getdns_return_t submit_query(getdns_context *context,
+			     getdns_dict *extensions,
+			     qinfo *qip, query_cb handler)
+{
+    getdns_transaction_t tid = 0;
+
+    qip->handler = handler;
+    TRACE2(dns_submit, qip->qname, qip->qtype);
+    if (qip->qtype == GETDNS_RRTYPE_A)
+	return getdns_address(context, qip->qname, extensions,
+			      (void *) qip, &tid, cb_query);
+    else
+	return getdns_general(context, qip->qname, qip->qtype, extensions,
+			      (void *) qip, &tid, cb_query);
+}
+
+
+void cb_tlsa(void *resp, void *userarg);
+
+
+/*
+ * query_cname_tlsa()
+ * If the address response was obtained by following a CNAME chain,
+ * issue a TLSA query at the expanded name too. The caller only does
+ * this when the whole chain is secure (RFC 7671, Section 7).
+ */
+
+void query_cname_tlsa(getdns_dict *response, const char *hostname,
+		      uint16_t port)
+{
+    getdns_return_t rc;
+    getdns_bindata *canonical_name;
+    char *fqdn = NULL;
+    size_t len;
+    qinfo *qip;
+
+    if (cname_target != NULL)
+	return;
+    if (getdns_dict_get_bindata(response, "canonical_name",
+				&canonical_name) != GETDNS_RETURN_GOOD)
+	return;
+    if (getdns_convert_dns_name_to_fqdn(canonical_name,
+					&fqdn) != GETDNS_RETURN_GOOD)
 	return;
+    if (same_domain_name(fqdn, hostname)) {
+	free(fqdn);
+	return;
+    }
+
+    len = strlen(fqdn);
+    if (len > 1 && fqdn[len-1] == '.')
+	fqdn[len-1] = '\0';
+    cname_target = fqdn;
+    snprintf(cname_domainstring, sizeof(cname_domainstring), "_%d._tcp.%s",
+	     port, cname_target);
+    if (debug)
+	fprintf(stdout, "%s is an alias for %s\n", hostname, cname_target);
+
+    qip = (qinfo *) malloc(sizeof(qinfo));
+    qip->qname = cname_domainstring;
+    qip->qtype = GETDNS_RRTYPE_TLSA;
+    qip->port = port;
+    qip->cname_target = 1;
+    rc = submit_query(dns_context, dns_extensions, qip, cb_tlsa);
+    if (rc != GETDNS_RETURN_GOOD)
+	fprintf(stderr, "ERROR: %s TLSA query failed: %s\n",
+		cname_domainstring, getdns_get_errorstr_by_id(rc));
+    return;
+}
+
+
+/*
+ * select_tlsa_base_domain()
+ * Choose between the TLSA records at the CNAME-expanded name and
+ * those at the original name. Secure TLSA records at the expanded
+ * name take precedence; otherwise the original name is used
+ * (RFC 7671, Section 7).
+ */
+
+void select_tlsa_base_domain(void)
+{
+    if (cname_tlsa_rdata_list != NULL && cname_tlsa_authenticated) {
+	free_tlsa(tlsa_rdata_list);
+	tlsa_rdata_list = cname_tlsa_rdata_list;
+	tlsa_count = cname_tlsa_count;
+	tlsa_authenticated = 1;
+	tlsa_base_domain = cname_target;
+    } else {
+	free_tlsa(cname_tlsa_rdata_list);
     }
+    cname_tlsa_rdata_list = NULL;
+    return;
+}
+
+
+/*
+ * callback function for address lookups
+ */
+
+void cb_address(void *resp, void *userarg)
+{
+    getdns_dict *response = (getdns_dict *) resp;
+    getdns_return_t rc;
+    uint32_t status=0;
+    qinfo *qip = (qinfo *) userarg;
+    const char *hostname = qip->qname;
+    uint16_t port = qip->port;
+    getdns_list    *just_addresses;
+    size_t         cnt_addr;
+    getdns_dict    *address;
+
+    if (response == NULL)
+	goto cleanup;
 
     /*
      * Check authenticated status of responses; set dns_bogus_indeterminate flag
@@ -273,6 +435,9 @@ void cb_address(getdns_context *ctx,
 	goto cleanup;
     }
 
+    if (auth_mode != MODE_PKIX && address_authenticated)
+	query_cname_tlsa(response, hostname, port);
+
     size_t i;
     struct addrinfo *current = addresses;
 
@@ -293,7 +458,6 @@ void cb_address(getdns_context *ctx,
 
 cleanup:
     free(qip);
-    getdns_dict_destroy(response);
     return;
 }
 
@@ -302,13 +466,9 @@ cleanup:
  * callback function for tlsa lookups
  */
 
-void cb_tlsa(getdns_context *ctx,
-	     getdns_callback_type_t cb_type,
-	     getdns_dict *response, 
-	     void *userarg,
-	     getdns_transaction_t tid)
+void cb_tlsa(void *resp, void *userarg)
 {
-    UNUSED_PARAM(ctx);
+    getdns_dict *response = (getdns_dict *) resp;
     getdns_return_t rc;
     uint32_t status=0, dstatus=0;
     qinfo *qip = (qinfo *) userarg;
@@ -317,28 +477,28 @@ void cb_tlsa(getdns_context *ctx,
     size_t         i, j, num_replies, num_answers;
     getdns_dict    *reply;
     char *cp;
-
-    switch (cb_type) {
-    case GETDNS_CALLBACK_COMPLETE:
-        break;
-    case GETDNS_CALLBACK_TIMEOUT:
-	fprintf(stderr, "Callback: TLSA query timed out: %s\n", hostname);
-	return;
-    case GETDNS_CALLBACK_CANCEL:
-    case GETDNS_CALLBACK_ERROR:
-    default:
-        fprintf(stderr, "Callback address fail: %s/TLSA, tid=%"PRIu64" rc=%d\n",
-                hostname, tid, cb_type);
-	return;
+    tlsa_rdata **listp = &tlsa_rdata_list;
+    size_t *countp = &tlsa_count;
+    int *authp = &tlsa_authenticated;
+
+    if (qip->cname_target) {
+	listp = &cname_tlsa_rdata_list;
+	countp = &cname_tlsa_count;
+	authp = &cname_tlsa_authenticated;
     }
 
+    if (response == NULL)
+	goto cleanup;
+
     (void) getdns_dict_get_int(response, "status", &status);
 
     switch (status) {
     case GETDNS_RESPSTATUS_GOOD:
         break;
     case GETDNS_RESPSTATUS_NO_NAME:
-        fprintf(stdout, "FAIL: %s: Non existent domain name.\n", hostname);
+	/* usual at the CNAME-expanded name: the original name is used */
+	if (!qip->cname_target)
+	    fprintf(stdout, "FAIL: %s: Non existent domain name.\n", hostname);
         goto cleanup;
     case GETDNS_RESPSTATUS_ALL_TIMEOUT:
         dns_bogus_or_indeterminate = 1;
@@ -372,7 +532,7 @@ void cb_tlsa(getdns_context *ctx,
 	goto cleanup;
     }
 
-    tlsa_rdata *current = tlsa_rdata_list;
+    tlsa_rdata *current = *listp;
     size_t auth_count = 0;
 
     for (i = 0; i < num_replies; i++) {
@@ -474,17 +634,16 @@ void cb_tlsa(getdns_context *ctx,
 	    rp->data = malloc(certdata->size);
 	    memcpy(rp->data, certdata->data, certdata->size);
 	    rp->next = NULL;
-	    current = insert_tlsa_rdata(&tlsa_rdata_list, current, rp);
-	    tlsa_count++;
+	    current = insert_tlsa_rdata(listp, current, rp);
+	    (*countp)++;
 	}
     }
 
     if (auth_count == num_replies)
-        tlsa_authenticated = 1;
+        *authp = 1;
 
 cleanup:
     free(qip);
-    getdns_dict_destroy(response);
     return;
 }
 
@@ -503,7 +662,6 @@ int do_dns_queries(const char *hostname, uint16_t port)
     getdns_context *context = NULL;
     getdns_dict *extensions = NULL;
     getdns_return_t rc;
-    getdns_transaction_t tid_addr = 0, tid_tlsa = 0;
     qinfo *qip_addr, *qip_tlsa;
     struct event_base *evb;
 
@@ -536,6 +694,8 @@ int do_dns_queries(const char *hostname, uint16_t port)
     }
 
     (void) getdns_extension_set_libevent_base(context, evb);
+    dns_context = context;
+    dns_extensions = extensions;
 
     /*
      * Address Records lookup
@@ -544,8 +704,8 @@ int do_dns_queries(const char *hostname, uint16_t port)
     qip_addr->qname = hostname;
     qip_addr->qtype = GETDNS_RRTYPE_A;
     qip_addr->port = port;
-    rc = getdns_address(context, hostname, extensions, 
-			(void *) qip_addr, &tid_addr, cb_address);
+    qip_addr->cname_target = 0;
+    rc = submit_query(context, extensions, qip_addr, cb_address);
     if (rc != GETDNS_RETURN_GOOD) {
 	fprintf(stderr, "ERROR: %s address query failed: %s\n",
 		hostname, getdns_get_errorstr_by_id(rc));
@@ -564,9 +724,8 @@ int do_dns_queries(const char *hostname, uint16_t port)
 	qip_tlsa->qname = domainstring;
 	qip_tlsa->qtype = GETDNS_RRTYPE_TLSA;
 	qip_tlsa->port = port;
-	rc = getdns_general(context, domainstring, GETDNS_RRTYPE_TLSA,
-			    extensions,
-			    (void *) qip_tlsa, &tid_tlsa, cb_tlsa);
+	qip_tlsa->cname_target = 0;
+	rc = submit_query(context, extensions, qip_tlsa, cb_tlsa);
 	if (rc != GETDNS_RETURN_GOOD) {
 	    fprintf(stderr, "ERROR: %s TLSA query failed: %s\n",
 		    domainstring, getdns_get_errorstr_by_id(rc));
@@ -583,8 +742,11 @@ int do_dns_queries(const char *hostname, uint16_t port)
 	return 0;
     }
 
+    select_tlsa_base_domain();
+
     event_base_free(evb);
     getdns_context_destroy(context);
+    dns_context = NULL;
 
     return 1;
 }
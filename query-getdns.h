@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <getdns/getdns.h>
 
 #include "tlsardata.h"
 
@@ -11,22 +12,26 @@
  * Flags: dns bogus or indeterminate; authenticate responses
  */
 
-int dns_bogus_or_indeterminate;
-int address_authenticated;
-int v4_authenticated;
-int v6_authenticated;
-int mx_authenticated;
-int srv_authenticated;
-int tlsa_authenticated;
+extern int dns_bogus_or_indeterminate;
+extern int address_authenticated;
+extern int v4_authenticated;
+extern int v6_authenticated;
+extern int mx_authenticated;
+extern int srv_authenticated;
+extern int tlsa_authenticated;
 
 /*
  * qinfo: structure to hold query information to be passed to
  * callback functions.
  */
+typedef void (*query_cb)(void *response, void *userarg);
+
 typedef struct qinfo {
     const char *qname;
     uint16_t qtype;
     uint16_t port;
+    int cname_target;	/* TLSA query at the CNAME-expanded name */
+    query_cb handler;	/* called with the response and the qinfo */
 } qinfo;
 
 
@@ -34,9 +39,9 @@ typedef struct qinfo {
  * addresses: (head of) linked list of addrinfo structures
  */
 
-size_t address_count;
+extern size_t address_count;
 
-struct addrinfo *addresses;
+extern struct addrinfo *addresses;
 
 struct addrinfo *
 insert_addrinfo(struct addrinfo *current, struct addrinfo *new);
@@ -46,10 +51,19 @@ insert_addrinfo(struct addrinfo *current, struct addrinfo *new);
  * tlsa_count: count of TLSA records.
  */
 
-size_t tlsa_count;
+extern size_t tlsa_count;
 
 int do_dns_queries(const char *hostname, uint16_t port);
 
-tlsa_rdata *tlsa_rdata_list;
+char *bindata2hexstring(getdns_bindata *b);
+
+extern tlsa_rdata *tlsa_rdata_list;
+
+/*
+ * tlsa_base_domain: CNAME-expanded name at which the selected TLSA
+ * records were found, or NULL if they are at the original name.
+ */
+
+extern char *tlsa_base_domain;
 
 #endif /* __QUERY_GETDNS_H__ */
@@ -22,6 +22,7 @@
 #include "utils.h"
 #include "common.h"
 #include "starttls.h"
+#include "trace.h"
 
 
 /*
@@ -60,6 +61,13 @@ insert_addrinfo(struct addrinfo **headp,
 
 size_t tlsa_count = 0;
 
+/*
+ * CNAME-expanded name of the host, and TLSA base domain (RFC 7671).
+ */
+
+char *cname_target = NULL;
+char *tlsa_base_domain = NULL;
+
 
 /*
  * rrlist_cat()
@@ -190,16 +198,41 @@ struct addrinfo *get_addresses(ldns_resolver *resolver,
 			       const char *hostname, uint16_t port)
 {
     ldns_rdf *host_rdf;
-    ldns_rr_list *rr_list = NULL;
+    ldns_rr_list *rr_list = NULL, *rr_list_type;
+    char *owner;
+    size_t len;
 
     host_rdf = ldns_dname_new_frm_str(hostname);
 
-    rrlist_cat(&rr_list,
-	       get_addresses_type(resolver, LDNS_RR_TYPE_AAAA, host_rdf));
-    rrlist_cat(&rr_list,
-	       get_addresses_type(resolver, LDNS_RR_TYPE_A, host_rdf));
+    TRACE2(dns_submit, hostname, LDNS_RR_TYPE_AAAA);
+    rr_list_type = get_addresses_type(resolver, LDNS_RR_TYPE_AAAA, host_rdf);
+    TRACE3(dns_complete, hostname, LDNS_RR_TYPE_AAAA, rr_list_type != NULL);
+    rrlist_cat(&rr_list, rr_list_type);
+
+    TRACE2(dns_submit, hostname, LDNS_RR_TYPE_A);
+    rr_list_type = get_addresses_type(resolver, LDNS_RR_TYPE_A, host_rdf);
+    TRACE3(dns_complete, hostname, LDNS_RR_TYPE_A, rr_list_type != NULL);
+    rrlist_cat(&rr_list, rr_list_type);
     ldns_rdf_deep_free(host_rdf);
 
+    /*
+     * The owner name of the address records is the CNAME-expanded
+     * name of the host; note it if it differs from the host name.
+     */
+    if (rr_list && ldns_rr_list_rr_count(rr_list) > 0) {
+	owner = ldns_rdf2str(ldns_rr_owner(ldns_rr_list_rr(rr_list, 0)));
+	if (owner && !same_domain_name(owner, hostname)) {
+	    len = strlen(owner);
+	    if (len > 1 && owner[len-1] == '.')
+		owner[len-1] = '\0';
+	    cname_target = owner;
+	    if (debug)
+		fprintf(stdout, "%s is an alias for %s\n",
+			hostname, cname_target);
+	} else
+	    free(owner);
+    }
+
     return load_addresses(rr_list, port);
 }
 
@@ -224,8 +257,10 @@ tlsa_rdata *get_tlsa(ldns_resolver *resolver,
     snprintf(domainstring, sizeof(domainstring), "_%d._tcp.%s", port, hostname);
     tlsa_owner = ldns_dname_new_frm_str(domainstring);
 
+    TRACE2(dns_submit, domainstring, LDNS_RR_TYPE_TLSA);
     ldns_p = ldns_resolver_query(resolver, tlsa_owner, LDNS_RR_TYPE_TLSA,
 				 LDNS_RR_CLASS_IN, LDNS_RD | LDNS_AD);
+    TRACE3(dns_complete, domainstring, LDNS_RR_TYPE_TLSA, ldns_p != NULL);
     ldns_rdf_deep_free(tlsa_owner);
 
     if (ldns_p == (ldns_pkt *) NULL) {
@@ -294,6 +329,34 @@ tlsa_rdata *get_tlsa(ldns_resolver *resolver,
 }
 
 
+/*
+ * get_tlsa_base(): get TLSA records at the TLSA base domain (RFC 7671,
+ * Section 7). If the host name is an alias and its address records
+ * (hence the CNAME chain) were authenticated, secure TLSA records at
+ * the CNAME-expanded name take precedence. Otherwise, those at the
+ * original name are used.
+ */
+
+tlsa_rdata *get_tlsa_base(ldns_resolver *resolver,
+			  const char *hostname, uint16_t port)
+{
+    tlsa_rdata *tlsa_rdata_list;
+
+    if (cname_target && v4_authenticated && v6_authenticated) {
+	tlsa_rdata_list = get_tlsa(resolver, cname_target, port);
+	if (tlsa_rdata_list != NULL && tlsa_authenticated) {
+	    tlsa_base_domain = cname_target;
+	    return tlsa_rdata_list;
+	}
+	free_tlsa(tlsa_rdata_list);
+	tlsa_count = 0;
+	tlsa_authenticated = 0;
+    }
+
+    return get_tlsa(resolver, hostname, port);
+}
+
+
 /*
  * get_resolver()
  * Initialize an ldns resolver. If conffile is NULL, then the system
@@ -13,18 +13,18 @@
  * Flags: dns bogus or indeterminate; authenticated responses 
  */
 
-int dns_bogus_or_indeterminate;
-int v4_authenticated;
-int v6_authenticated;
-int mx_authenticated;
-int srv_authenticated;
-int tlsa_authenticated;
+extern int dns_bogus_or_indeterminate;
+extern int v4_authenticated;
+extern int v6_authenticated;
+extern int mx_authenticated;
+extern int srv_authenticated;
+extern int tlsa_authenticated;
 
 /*
  * addresses: (head of) linked list of addrinfo structures
  */
 
-size_t address_count;
+extern size_t address_count;
 
 struct addrinfo *
 insert_addrinfo(struct addrinfo **headp,
@@ -32,11 +32,10 @@ insert_addrinfo(struct addrinfo **headp,
 
 
 /*
- * tlsa_count and response_rcode
+ * tlsa_count
  */
 
-size_t tlsa_count;
-ldns_pkt_rcode tlsa_response_rcode;
+extern size_t tlsa_count;
 
 /*
  * get_addresses_type() and get_addresses()
@@ -58,6 +57,18 @@ struct addrinfo *get_addresses(ldns_resolver *resolver,
 tlsa_rdata *get_tlsa(ldns_resolver *resolver, 
 		     const char *hostname, uint16_t port);
 
+/*
+ * cname_target: CNAME-expanded name of the host, if it is an alias.
+ * tlsa_base_domain: set to cname_target if the TLSA records in use
+ * were found there, NULL if they are at the original name.
+ */
+
+extern char *cname_target;
+extern char *tlsa_base_domain;
+
+tlsa_rdata *get_tlsa_base(ldns_resolver *resolver,
+			  const char *hostname, uint16_t port);
+
 ldns_resolver *get_resolver(char *conffile);
 
 #endif /* __QUERY_LDNS_H__ */
@@ -0,0 +1,495 @@
+/*
+ * query-unbound.c
+ *
+ * Query Address and TLSA records with libunbound, which performs
+ * DNSSEC validation in process.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <openssl/ssl.h>
+
+#include <unbound.h>
+
+#include "query-unbound.h"
+#include "trace.h"
+#include "utils.h"
+#include "common.h"
+#include "starttls.h"
+
+extern int debug;
+extern int recursion;
+extern char *trust_anchor_file;
+extern enum AUTH_MODE auth_mode;
+
+
+/*
+ * Flags: dns bogus or indeterminate; authenticated responses
+ */
+
+int dns_bogus_or_indeterminate = 0;
+int v4_authenticated = 0;
+int v6_authenticated = 0;
+int mx_authenticated = 0;
+int srv_authenticated = 0;
+int tlsa_authenticated = 0;
+
+/*
+ * addresses: (head of) linked list of addrinfo structures
+ */
+
+size_t address_count = 0;
+struct addrinfo *addresses = NULL;
+
+struct addrinfo *
+insert_addrinfo(struct addrinfo *current, struct addrinfo *new)
+{
+    if (current == NULL)
+        addresses = new;
+    else
+        current->ai_next = new;
+    return new;
+}
+
+/*
+ * tlsa_count: count of TLSA records.
+ * tlsa_rdata_list: linked list of tlsa_rdata structures.
+ */
+
+size_t tlsa_count = 0;
+tlsa_rdata *tlsa_rdata_list = NULL;
+
+/*
+ * TLSA records at the CNAME-expanded name of the host (RFC 7671),
+ * kept apart until one of the two candidate sets is selected.
+ */
+
+char *tlsa_base_domain = NULL;
+char *cname_target = NULL;
+char cname_domainstring[512];
+size_t cname_tlsa_count = 0;
+int cname_tlsa_authenticated = 0;
+tlsa_rdata *cname_tlsa_rdata_list = NULL;
+
+
+/*
+ * get_ub_context()
+ * Return the resolver context, creating it on first use. A single
+ * context is kept for the life of the process, so that its caches
+ * (including validated DNSKEY and DS records) are shared by all
+ * queries. Resolution and validation run in a background thread.
+ */
+
+static struct ub_ctx *ub_context = NULL;
+
+struct ub_ctx *get_ub_context(void)
+{
+    int rc;
+    struct ub_ctx *ctx;
+
+    if (ub_context != NULL)
+	return ub_context;
+
+    if ((ctx = ub_ctx_create()) == NULL) {
+	fprintf(stderr, "FAIL: Error creating unbound context.\n");
+	return NULL;
+    }
+
+    if (!recursion && (rc = ub_ctx_resolvconf(ctx, NULL)) != 0) {
+	fprintf(stderr, "FAIL: Error reading resolver configuration: %s\n",
+		ub_strerror(rc));
+	ub_ctx_delete(ctx);
+	return NULL;
+    }
+
+    if ((rc = ub_ctx_add_ta_file(ctx, trust_anchor_file)) != 0) {
+	fprintf(stderr, "FAIL: Error loading trust anchor %s: %s\n",
+		trust_anchor_file, ub_strerror(rc));
+	ub_ctx_delete(ctx);
+	return NULL;
+    }
+
+    if ((rc = ub_ctx_async(ctx, 1)) != 0) {
+	fprintf(stderr, "FAIL: Error enabling threaded resolution: %s\n",
+		ub_strerror(rc));
+	ub_ctx_delete(ctx);
+	return NULL;
+    }
+
+    ub_context = ctx;
+    return ub_context;
+}
+
+
+/*
+ * make_addrinfo(): build an addrinfo structure from A or AAAA rdata.
+ */
+
+struct addrinfo *make_addrinfo(int qtype, char *data, int len, uint16_t port)
+{
+    struct addrinfo *aip = NULL;
+
+    if (qtype == UB_RRTYPE_A && len == 4) {
+	struct sockaddr_in *sa4 = malloc(sizeof(struct sockaddr_storage));
+	aip = malloc(sizeof(struct addrinfo));
+	aip->ai_family = sa4->sin_family = AF_INET;
+	sa4->sin_port = htons(port);
+	memcpy(&(sa4->sin_addr), data, len);
+	aip->ai_addr = (struct sockaddr *) sa4;
+	aip->ai_addrlen = sizeof(struct sockaddr_in);
+    } else if (qtype == UB_RRTYPE_AAAA && len == 16) {
+	struct sockaddr_in6 *sa6 = malloc(sizeof(struct sockaddr_storage));
+	aip = malloc(sizeof(struct addrinfo));
+	aip->ai_family = sa6->sin6_family = AF_INET6;
+	sa6->sin6_port = htons(port);
+	memcpy(&(sa6->sin6_addr), data, len);
+	aip->ai_addr = (struct sockaddr *) sa6;
+	aip->ai_addrlen = sizeof(struct sockaddr_in6);
+    } else {
+	fprintf(stderr, "FAIL: Malformed address rdata (type %d, length %d)\n",
+		qtype, len);
+	return NULL;
+    }
+
+    aip->ai_flags = 0;
+    aip->ai_canonname = NULL;
+    aip->ai_next = NULL;
+    return aip;
+}
+
+
+/*
+ * check_result(): check the rcode and DNSSEC status of a result.
+ * Returns 1 if the result holds usable data, 0 otherwise.
+ */
+
+int check_result(struct ub_result *result, const char *qname)
+{
+    if (result->bogus) {
+	dns_bogus_or_indeterminate = 1;
+	fprintf(stdout, "FAIL: %s: Bogus answer: %s\n", qname,
+		result->why_bogus ? result->why_bogus : "(no reason given)");
+	return 0;
+    }
+
+    if (result->nxdomain) {
+	fprintf(stdout, "FAIL: %s: Non existent domain name.\n", qname);
+	return 0;
+    }
+
+    if (result->rcode != 0) {
+	dns_bogus_or_indeterminate = 1;
+	fprintf(stdout, "FAIL: %s: error rcode: %d.\n", qname, result->rcode);
+	return 0;
+    }
+
+    return result->havedata;
+}
+
+
+/*
+ * cb_query(): libunbound callback for all queries. Passes the result
+ * to the handler of the query, and frees it afterwards. The handler
+ * gets a NULL result if the query failed.
+ */
+
+void cb_query(void *mydata, int err, struct ub_result *result)
+{
+    qinfo *qip = (qinfo *) mydata;
+
+    if (err != 0) {
+	fprintf(stderr, "Callback: query failed: %s/%d: %s\n",
+		qip->qname, qip->qtype, ub_strerror(err));
+	TRACE3(dns_complete, qip->qname, qip->qtype, 0);
+	qip->handler(NULL, (void *) qip);
+	return;
+    }
+
+    TRACE3(dns_complete, qip->qname, qip->qtype, 1);
+    qip->handler((void *) result, (void *) qip);
+    ub_resolve_free(result);
+    return;
+}
+
+
+/*
+ * submit_query()
+ * Dispatch the query described by qip. handler is called with the
+ * result and qip once the answer arrives.
+ */
+
+int submit_query(struct ub_ctx *ctx, qinfo *qip, query_cb handler)
+{
+    int async_id;
+
+    qip->handler = handler;
+    TRACE2(dns_submit, qip->qname, qip->qtype);
+    return ub_resolve_async(ctx, qip->qname, qip->qtype, UB_RRCLASS_IN,
+			    (void *) qip, cb_query, &async_id);
+}
+
+
+/*
+ * new_qinfo()
+ */
+
+qinfo *new_qinfo(const char *qname, uint16_t qtype, uint16_t port)
+{
+    qinfo *qip = (qinfo *) malloc(sizeof(qinfo));
+    qip->qname = qname;
+    qip->qtype = qtype;
+    qip->port = port;
+    qip->cname_target = 0;
+    return qip;
+}
+
+
+void cb_tlsa(void *resp, void *userarg);
+
+
+/*
+ * query_cname_tlsa()
+ * If the address result was obtained by following a CNAME chain,
+ * issue a TLSA query at the expanded name too. The caller only does
+ * this when the whole chain is secure (RFC 7671, Section 7).
+ */
+
+void query_cname_tlsa(struct ub_result *result, const char *hostname,
+		      uint16_t port)
+{
+    size_t len;
+    qinfo *qip;
+    int rc;
+
+    if (cname_target != NULL || result->canonname == NULL ||
+	same_domain_name(result->canonname, hostname))
+	return;
+
+    cname_target = strdup(result->canonname);
+    len = strlen(cname_target);
+    if (len > 1 && cname_target[len-1] == '.')
+	cname_target[len-1] = '\0';
+    snprintf(cname_domainstring, sizeof(cname_domainstring), "_%d._tcp.%s",
+	     port, cname_target);
+    if (debug)
+	fprintf(stdout, "%s is an alias for %s\n", hostname, cname_target);
+
+    qip = new_qinfo(cname_domainstring, UB_RRTYPE_TLSA, port);
+    qip->cname_target = 1;
+    if ((rc = submit_query(get_ub_context(), qip, cb_tlsa)) != 0)
+	fprintf(stderr, "ERROR: %s TLSA query failed: %s\n",
+		cname_domainstring, ub_strerror(rc));
+    return;
+}
+
+
+/*
+ * select_tlsa_base_domain()
+ * Choose between the TLSA records at the CNAME-expanded name and
+ * those at the original name. Secure TLSA records at the expanded
+ * name take precedence; otherwise the original name is used
+ * (RFC 7671, Section 7).
+ */
+
+void select_tlsa_base_domain(void)
+{
+    if (cname_tlsa_rdata_list != NULL && cname_tlsa_authenticated) {
+	free_tlsa(tlsa_rdata_list);
+	tlsa_rdata_list = cname_tlsa_rdata_list;
+	tlsa_count = cname_tlsa_count;
+	tlsa_authenticated = 1;
+	tlsa_base_domain = cname_target;
+    } else {
+	free_tlsa(cname_tlsa_rdata_list);
+    }
+    cname_tlsa_rdata_list = NULL;
+    return;
+}
+
+
+/*
+ * callback function for address lookups (A and AAAA)
+ */
+
+void cb_address(void *resp, void *userarg)
+{
+    struct ub_result *result = (struct ub_result *) resp;
+    qinfo *qip = (qinfo *) userarg;
+    struct addrinfo *current, *aip;
+    int i;
+
+    if (result == NULL)
+	goto cleanup;
+
+    if (result->secure) {
+	if (qip->qtype == UB_RRTYPE_AAAA)
+	    v6_authenticated = 1;
+	else
+	    v4_authenticated = 1;
+    }
+
+    if (!check_result(result, qip->qname))
+	goto cleanup;
+
+    if (auth_mode != MODE_PKIX && result->secure)
+	query_cname_tlsa(result, qip->qname, qip->port);
+
+    for (current = addresses; current && current->ai_next;
+	 current = current->ai_next)
+	;
+
+    for (i = 0; result->data[i] != NULL; i++) {
+	aip = make_addrinfo(qip->qtype, result->data[i], result->len[i],
+			    qip->port);
+	if (! aip)
+	    continue;
+	current = insert_addrinfo(current, aip);
+	address_count++;
+    }
+
+cleanup:
+    free(qip);
+    return;
+}
+
+
+/*
+ * callback function for tlsa lookups
+ */
+
+void cb_tlsa(void *resp, void *userarg)
+{
+    struct ub_result *result = (struct ub_result *) resp;
+    qinfo *qip = (qinfo *) userarg;
+    tlsa_rdata **listp = &tlsa_rdata_list;
+    size_t *countp = &tlsa_count;
+    int *authp = &tlsa_authenticated;
+    tlsa_rdata *current;
+    uint8_t *rdata;
+    char *cp;
+    int i;
+
+    if (qip->cname_target) {
+	listp = &cname_tlsa_rdata_list;
+	countp = &cname_tlsa_count;
+	authp = &cname_tlsa_authenticated;
+    }
+    current = *listp;
+
+    if (result == NULL) {
+	dns_bogus_or_indeterminate = 1;
+	goto cleanup;
+    }
+
+    /* usual at the CNAME-expanded name: the original name is used */
+    if (qip->cname_target && result->nxdomain)
+	goto cleanup;
+
+    if (!check_result(result, qip->qname))
+	goto cleanup;
+
+    if (result->secure)
+	*authp = 1;
+    else
+	fprintf(stdout, "TLSA response %s is insecure.\n", qip->qname);
+
+    for (i = 0; result->data[i] != NULL; i++) {
+
+	rdata = (uint8_t *) result->data[i];
+	if (result->len[i] < 4) {
+	    fprintf(stderr, "FAIL: %s/TLSA: malformed rdata.\n", qip->qname);
+	    continue;
+	}
+
+	if ((starttls == STARTTLS_SMTP) && (smtp_any_mode != 1)) {
+	    if (!(rdata[0] == 2 || rdata[0] == 3)) {
+		fprintf(stdout, "TLSA record with invalid usage mode "
+			"for SMTP: %d %d %d [%s..].\n",
+			rdata[0], rdata[1], rdata[2],
+			(cp = bin2hexstring(rdata + 3,
+					    (result->len[i] - 3 > 6) ?
+					    6 : result->len[i] - 3)));
+		free(cp);
+		continue;
+	    }
+	}
+
+	tlsa_rdata *rp = (tlsa_rdata *) malloc(sizeof(tlsa_rdata));
+	rp->usage = rdata[0];
+	rp->selector = rdata[1];
+	rp->mtype = rdata[2];
+	rp->data_len = result->len[i] - 3;
+	rp->data = malloc(rp->data_len);
+	memcpy(rp->data, rdata + 3, rp->data_len);
+	rp->next = NULL;
+	current = insert_tlsa_rdata(listp, current, rp);
+	(*countp)++;
+    }
+
+cleanup:
+    free(qip);
+    return;
+}
+
+
+/*
+ * do_dns_queries()
+ * asynchronously dispatch address and TLSA queries & wait for results.
+ * Response data is obtained by the associated callback functions.
+ */
+
+int do_dns_queries(const char *hostname, uint16_t port)
+{
+    char domainstring[512];
+    struct ub_ctx *ctx;
+    int rc;
+
+    if ((ctx = get_ub_context()) == NULL)
+	return 0;
+
+    /*
+     * Address Records lookup
+     */
+    if ((rc = submit_query(ctx, new_qinfo(hostname, UB_RRTYPE_AAAA, port),
+			   cb_address)) != 0 ||
+	(rc = submit_query(ctx, new_qinfo(hostname, UB_RRTYPE_A, port),
+			   cb_address)) != 0) {
+	fprintf(stderr, "ERROR: %s address query failed: %s\n",
+		hostname, ub_strerror(rc));
+	return 0;
+    }
+
+    /*
+     * TLSA Records lookup
+     */
+    if (auth_mode != MODE_PKIX) {
+	snprintf(domainstring, sizeof(domainstring), "_%d._tcp.%s",
+		 port, hostname);
+	if ((rc = submit_query(ctx,
+			       new_qinfo(domainstring, UB_RRTYPE_TLSA, port),
+			       cb_tlsa)) != 0) {
+	    fprintf(stderr, "ERROR: %s TLSA query failed: %s\n",
+		    domainstring, ub_strerror(rc));
+	    return 0;
+	}
+    }
+
+    if ((rc = ub_wait(ctx)) != 0) {
+	fprintf(stderr, "Error waiting for DNS responses: %s\n",
+		ub_strerror(rc));
+	return 0;
+    }
+
+    select_tlsa_base_domain();
+
+    return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef __QUERY_UNBOUND_H__
+#define __QUERY_UNBOUND_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tlsardata.h"
+
+/*
+ * RR types and class used in queries
+ */
+
+#define UB_RRTYPE_A     1
+#define UB_RRTYPE_AAAA  28
+#define UB_RRTYPE_TLSA  52
+#define UB_RRCLASS_IN   1
+
+/*
+ * Flags: dns bogus or indeterminate; authenticated responses
+ */
+
+extern int dns_bogus_or_indeterminate;
+extern int v4_authenticated;
+extern int v6_authenticated;
+extern int mx_authenticated;
+extern int srv_authenticated;
+extern int tlsa_authenticated;
+
+/*
+ * qinfo: structure to hold query information to be passed to
+ * callback functions.
+ */
+typedef void (*query_cb)(void *response, void *userarg);
+
+typedef struct qinfo {
+    const char *qname;
+    uint16_t qtype;
+    uint16_t port;
+    int cname_target;	/* TLSA query at the CNAME-expanded name */
+    query_cb handler;	/* called with the response and the qinfo */
+} qinfo;
+
+
+/*
+ * addresses: (head of) linked list of addrinfo structures
+ */
+
+extern size_t address_count;
+
+extern struct addrinfo *addresses;
+
+struct addrinfo *
+insert_addrinfo(struct addrinfo *current, struct addrinfo *new);
+
+
+/*
+ * tlsa_count: count of TLSA records.
+ */
+
+extern size_t tlsa_count;
+
+extern tlsa_rdata *tlsa_rdata_list;
+
+/*
+ * tlsa_base_domain: CNAME-expanded name at which the selected TLSA
+ * records were found, or NULL if they are at the original name.
+ */
+
+extern char *tlsa_base_domain;
+
+int do_dns_queries(const char *hostname, uint16_t port);
+
+#endif /* __QUERY_UNBOUND_H__ */
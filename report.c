@@ -0,0 +1,168 @@
+/*
+ * report.c
+ *
+ * End of sweep report (--report). The results file is read once; the
+ * timings of each phase are fed to a quantile sketch and a heap of the
+ * slowest peers, so memory use does not depend on the number of
+ * records and nothing is sorted but the top-n lists.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+
+#include "common.h"
+#include "report.h"
+#include "results.h"
+#include "sketch.h"
+
+#define MAX_FIELD	256
+#define MAX_ERRORS	16
+
+enum REPORT_PHASE {
+    PHASE_CONNECT=0,
+    PHASE_STARTTLS,
+    PHASE_HANDSHAKE,
+    PHASE_TOTAL,
+    NPHASES
+};
+
+static const char *phase_names[NPHASES] = {
+    "connect", "starttls", "handshake", "total"
+};
+
+static const char *phase_fields[NPHASES] = {
+    "connect_us", "starttls_us", "handshake_us", NULL
+};
+
+
+/*
+ * report_results(): read the results file at path and print the
+ * report. Returns 0 on success, 2 if the file cannot be read or the
+ * report cannot be allocated.
+ */
+
+int report_results(const char *path)
+{
+    FILE *fp;
+    sketch *sketches;
+    top_heap slowest[NPHASES];
+    struct {
+	char name[MAX_FIELD];
+	size_t count;
+    } errors[MAX_ERRORS];
+    size_t nerrors = 0, records = 0, failed = 0, n;
+    char *line = NULL, value[MAX_FIELD], host[MAX_FIELD], port[MAX_FIELD],
+	address[MAX_FIELD], label[3 * MAX_FIELD];
+    size_t size = 0;
+    double usec, total;
+    int i;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	fprintf(stdout, "Unable to open results file %s.\n", path);
+	return 2;
+    }
+
+    if ((sketches = (sketch *) malloc(NPHASES * sizeof(sketch))) == NULL) {
+	fprintf(stdout, "Unable to allocate report.\n");
+	fclose(fp);
+	return 2;
+    }
+    for (i = 0; i < NPHASES; i++) {
+	sketch_init(&sketches[i]);
+	if (!top_init(&slowest[i], report_top)) {
+	    fprintf(stdout, "Unable to allocate report.\n");
+	    while (i > 0)
+		top_free(&slowest[--i]);
+	    free(sketches);
+	    fclose(fp);
+	    return 2;
+	}
+    }
+
+    while (getline(&line, &size, fp) != -1) {
+	if (!get_result_field(line, "host", host, MAX_FIELD) ||
+	    !get_result_field(line, "port", port, MAX_FIELD) ||
+	    !get_result_field(line, "address", address, MAX_FIELD))
+	    continue;
+	records++;
+	snprintf(label, sizeof(label), "%s %s %s", host, port, address);
+
+	(void) get_result_field(line, "status", value, MAX_FIELD);
+	if (strcmp(value, "ok") != 0) {
+	    failed++;
+	    (void) get_result_field(line, "error", value, MAX_FIELD);
+	    for (n = 0; n < nerrors; n++) {
+		if (strcmp(errors[n].name, value) == 0)
+		    break;
+	    }
+	    if (n == nerrors && nerrors < MAX_ERRORS) {
+		snprintf(errors[n].name, MAX_FIELD, "%s", value);
+		errors[n].count = 0;
+		nerrors++;
+	    }
+	    if (n < nerrors)
+		errors[n].count++;
+	}
+
+	/* phases that did not take place have no time recorded */
+	total = 0.0;
+	for (i = 0; i < PHASE_TOTAL; i++) {
+	    if (!get_result_field(line, phase_fields[i], value, MAX_FIELD) ||
+		(usec = atof(value)) <= 0.0)
+		continue;
+	    total += usec;
+	    sketch_add(&sketches[i], usec);
+	    top_add(&slowest[i], usec, label);
+	}
+	if (total > 0.0) {
+	    sketch_add(&sketches[PHASE_TOTAL], total);
+	    top_add(&slowest[PHASE_TOTAL], total, label);
+	}
+    }
+    free(line);
+    fclose(fp);
+
+    fprintf(stdout, "Report: %zu peers, %zu authenticated, %zu failed\n",
+	    records, records - failed, failed);
+    if (nerrors > 0) {
+	fprintf(stdout, "Failures:");
+	for (n = 0; n < nerrors; n++)
+	    fprintf(stdout, " %s %zu", errors[n].name, errors[n].count);
+	fprintf(stdout, "\n");
+    }
+
+    fprintf(stdout, "\n%-10s %10s %10s %10s %10s %10s\n", "Phase (ms)",
+	    "count", "p50", "p90", "p99", "max");
+    for (i = 0; i < NPHASES; i++) {
+	if (sketches[i].count == 0)
+	    continue;
+	fprintf(stdout, "%-10s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f\n",
+		phase_names[i], sketches[i].count,
+		sketch_quantile(&sketches[i], 0.50) / 1000.0,
+		sketch_quantile(&sketches[i], 0.90) / 1000.0,
+		sketch_quantile(&sketches[i], 0.99) / 1000.0,
+		sketches[i].max / 1000.0);
+    }
+
+    for (i = 0; i < NPHASES; i++) {
+	if (slowest[i].count == 0)
+	    continue;
+	top_sort(&slowest[i]);
+	fprintf(stdout, "\nSlowest %s:\n", phase_names[i]);
+	for (n = 0; n < slowest[i].count; n++)
+	    fprintf(stdout, "%10.1f ms  %s\n",
+		    slowest[i].entries[n].value / 1000.0,
+		    slowest[i].entries[n].label);
+    }
+
+    for (i = 0; i < NPHASES; i++)
+	top_free(&slowest[i]);
+    free(sketches);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __REPORT_H__
+#define __REPORT_H__
+
+/*
+ * Timing report over a results file (as written with --results):
+ * quantiles of each phase's timings, the slowest peers per phase,
+ * and failures by stage.
+ */
+
+int report_results(const char *path);
+
+#endif /* __REPORT_H__ */
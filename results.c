@@ -0,0 +1,137 @@
+/*
+ * results.c
+ *
+ * Write per peer results delivered by do_tls() to a results file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+
+#include <openssl/ssl.h>
+
+#include "results.h"
+#include "utils.h"
+
+#define MAX_TLSA_HEX 32
+
+static FILE *results_fp = NULL;
+
+
+/*
+ * write_result(): result callback; writes one line to the FILE in
+ * userarg, e.g.
+ * host=www.example.com port=443 address=192.0.2.1 status=ok error=-
+ * verify=0 version=TLSv1.3 cipher=TLS_AES_256_GCM_SHA384 dane=3,1,1
+ * tlsa=b760c12119c3... cert=<sha256 of certificate> peername=-
+ * starttls_sent=0 starttls_received=0 starttls_round_trips=0
+ * handshake_sent=517 handshake_received=4853 handshake_round_trips=1
+ * connect_us=10532 starttls_us=48211 handshake_us=31377
+ */
+
+void write_result(tls_result *result, void *userarg)
+{
+    FILE *fp = (FILE *) userarg;
+    char *tlsa_hex = NULL;
+
+    if (result->dane_depth >= 0 && result->tlsa_data != NULL)
+	tlsa_hex = bin2hexstring((uint8_t *) result->tlsa_data,
+				 (result->tlsa_data_len > MAX_TLSA_HEX) ?
+				 MAX_TLSA_HEX : result->tlsa_data_len);
+
+    fprintf(fp, "host=%s port=%d address=%s status=%s error=%s verify=%ld",
+	    result->hostname, result->port, result->address,
+	    result->authenticated ? "ok" : "fail",
+	    result->error ? result->error : "-",
+	    result->verify_rc);
+    fprintf(fp, " version=%s cipher=%s",
+	    result->tls_version ? result->tls_version : "-",
+	    result->cipher ? result->cipher : "-");
+    if (result->dane_depth >= 0)
+	fprintf(fp, " dane=%d,%d,%d tlsa=%s", result->usage,
+		result->selector, result->mtype, tlsa_hex ? tlsa_hex : "-");
+    else
+	fprintf(fp, " dane=- tlsa=-");
+    fprintf(fp, " cert=%s peername=%s",
+	    result->cert_sha256[0] ? result->cert_sha256 : "-",
+	    result->peername ? result->peername : "-");
+    fprintf(fp, " starttls_sent=%zu starttls_received=%zu"
+	    " starttls_round_trips=%d",
+	    result->starttls_io.bytes_sent, result->starttls_io.bytes_received,
+	    result->starttls_io.round_trips);
+    fprintf(fp, " handshake_sent=%zu handshake_received=%zu"
+	    " handshake_round_trips=%d",
+	    result->handshake_io.bytes_sent, result->handshake_io.bytes_received,
+	    result->handshake_io.round_trips);
+    fprintf(fp, " connect_us=%" PRIu64 " starttls_us=%" PRIu64
+	    " handshake_us=%" PRIu64 "\n", result->connect_usec,
+	    result->starttls_usec, result->handshake_usec);
+
+    free(tlsa_hex);
+    return;
+}
+
+
+/*
+ * get_result_field(): copy the value of field name from a results
+ * line into buf. Returns 0 (and sets buf to "-") if the line has no
+ * such field.
+ */
+
+int get_result_field(const char *line, const char *name, char *buf,
+		     size_t size)
+{
+    const char *cp = line, *end;
+    size_t namelen = strlen(name), len;
+
+    while (*cp) {
+	if (strncmp(cp, name, namelen) == 0 && cp[namelen] == '=') {
+	    cp += namelen + 1;
+	    end = cp + strcspn(cp, " \n");
+	    len = end - cp;
+	    if (len >= size)
+		len = size - 1;
+	    memcpy(buf, cp, len);
+	    buf[len] = '\0';
+	    return 1;
+	}
+	cp += strcspn(cp, " ");
+	cp += strspn(cp, " ");
+    }
+    snprintf(buf, size, "-");
+    return 0;
+}
+
+
+/*
+ * open_results(): open the results file for appending and arrange for
+ * do_tls() to write a line per peer to it.
+ */
+
+int open_results(const char *path)
+{
+    if ((results_fp = fopen(path, "a")) == NULL) {
+	fprintf(stderr, "Unable to open results file %s.\n", path);
+	return 0;
+    }
+    (void) add_tls_result_callback(write_result, (void *) results_fp);
+    return 1;
+}
+
+
+/*
+ * close_results()
+ */
+
+void close_results(void)
+{
+    if (results_fp) {
+	remove_tls_result_callback(write_result);
+	fclose(results_fp);
+	results_fp = NULL;
+    }
+    return;
+}
@@ -0,0 +1,21 @@
+#ifndef __RESULTS_H__
+#define __RESULTS_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tls.h"
+
+/*
+ * Structured results file: one line per peer address, made up of
+ * space separated key=value fields, with "-" for absent values.
+ */
+
+void write_result(tls_result *result, void *userarg);
+int get_result_field(const char *line, const char *name, char *buf,
+		     size_t size);
+int open_results(const char *path);
+void close_results(void);
+
+#endif /* __RESULTS_H__ */
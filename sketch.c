@@ -0,0 +1,191 @@
+/*
+ * sketch.c
+ *
+ * Streaming quantile sketch and top-n heap, for timing reports over
+ * any number of measurements in bounded memory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sketch.h"
+
+/*
+ * Bucket i holds values in (gamma^(i-1), gamma^i], with
+ * gamma = (1 + accuracy) / (1 - accuracy).
+ */
+
+static double sketch_gamma(void)
+{
+    return (1.0 + SKETCH_ACCURACY) / (1.0 - SKETCH_ACCURACY);
+}
+
+
+/*
+ * sketch_init()
+ */
+
+void sketch_init(sketch *s)
+{
+    memset(s, 0, sizeof(sketch));
+    return;
+}
+
+
+/*
+ * sketch_add(): add one value.
+ */
+
+void sketch_add(sketch *s, double value)
+{
+    int i;
+
+    if (s->count == 0 || value < s->min)
+	s->min = value;
+    if (s->count == 0 || value > s->max)
+	s->max = value;
+    s->count++;
+
+    if (value < 1.0) {
+	s->zero_count++;
+	return;
+    }
+    i = (int) ceil(log(value) / log(sketch_gamma()));
+    if (i >= SKETCH_BUCKETS)
+	i = SKETCH_BUCKETS - 1;
+    s->buckets[i]++;
+    return;
+}
+
+
+/*
+ * sketch_quantile(): estimate the q-quantile (0 <= q <= 1).
+ */
+
+double sketch_quantile(sketch *s, double q)
+{
+    uint64_t rank, seen;
+    double gamma = sketch_gamma(), value;
+    int i;
+
+    if (s->count == 0)
+	return 0.0;
+    rank = (uint64_t) (q * (s->count - 1));
+
+    if (rank < s->zero_count)
+	return s->min;
+    seen = s->zero_count;
+    for (i = 0; i < SKETCH_BUCKETS; i++) {
+	seen += s->buckets[i];
+	if (seen > rank)
+	    break;
+    }
+    if (i == SKETCH_BUCKETS)
+	return s->max;
+
+    /* midpoint of the bucket, within the observed range */
+    value = 2.0 * pow(gamma, i) / (gamma + 1.0);
+    if (value < s->min)
+	value = s->min;
+    if (value > s->max)
+	value = s->max;
+    return value;
+}
+
+
+/*
+ * top_init(): heap for the size largest values. Returns 0 if it
+ * cannot be allocated; the heap is then empty, with size 0.
+ */
+
+int top_init(top_heap *h, size_t size)
+{
+    h->entries = (top_entry *) calloc(size ? size : 1, sizeof(top_entry));
+    h->count = 0;
+    h->size = h->entries ? size : 0;
+    return h->entries != NULL;
+}
+
+
+/*
+ * top_sift_down(): restore the min-heap property below entry i,
+ * among the first n entries.
+ */
+
+static void top_sift_down(top_entry *e, size_t n, size_t i)
+{
+    top_entry tmp;
+    size_t child;
+
+    while ((child = 2 * i + 1) < n) {
+	if (child + 1 < n && e[child + 1].value < e[child].value)
+	    child++;
+	if (e[i].value <= e[child].value)
+	    break;
+	tmp = e[i]; e[i] = e[child]; e[child] = tmp;
+	i = child;
+    }
+    return;
+}
+
+
+/*
+ * top_add(): add a value, if it is among the largest seen so far.
+ */
+
+void top_add(top_heap *h, double value, const char *label)
+{
+    top_entry tmp, *e = h->entries;
+    size_t i, parent;
+
+    if (h->size == 0)
+	return;
+
+    if (h->count < h->size) {
+	i = h->count++;
+	e[i].value = value;
+	snprintf(e[i].label, TOP_LABEL_MAX, "%s", label);
+	while (i > 0 && e[(parent = (i - 1) / 2)].value > e[i].value) {
+	    tmp = e[i]; e[i] = e[parent]; e[parent] = tmp;
+	    i = parent;
+	}
+    } else if (value > e[0].value) {
+	e[0].value = value;
+	snprintf(e[0].label, TOP_LABEL_MAX, "%s", label);
+	top_sift_down(e, h->count, 0);
+    }
+    return;
+}
+
+
+/*
+ * top_sort(): sort the entries, largest first (destroys the heap).
+ */
+
+void top_sort(top_heap *h)
+{
+    top_entry tmp, *e = h->entries;
+    size_t n;
+
+    for (n = h->count; n > 1; n--) {
+	tmp = e[0]; e[0] = e[n - 1]; e[n - 1] = tmp;
+	top_sift_down(e, n - 1, 0);
+    }
+    return;
+}
+
+
+/*
+ * top_free()
+ */
+
+void top_free(top_heap *h)
+{
+    free(h->entries);
+    h->entries = NULL;
+    h->count = h->size = 0;
+    return;
+}
@@ -0,0 +1,50 @@
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * sketch: streaming quantile estimate of positive values (DDSketch
+ * style), with logarithmic buckets so that every quantile is within
+ * SKETCH_ACCURACY relative error, in fixed memory.
+ */
+
+#define SKETCH_ACCURACY	0.01
+#define SKETCH_BUCKETS	2048
+
+typedef struct sketch {
+    uint64_t count;
+    uint64_t zero_count;		/* values below 1 */
+    double min, max;
+    uint64_t buckets[SKETCH_BUCKETS];
+} sketch;
+
+void sketch_init(sketch *s);
+void sketch_add(sketch *s, double value);
+double sketch_quantile(sketch *s, double q);
+
+/*
+ * top_heap: the n largest values seen, with a label each, kept in a
+ * min-heap of fixed size.
+ */
+
+#define TOP_LABEL_MAX 320	/* host, port and address */
+
+typedef struct top_entry {
+    double value;
+    char label[TOP_LABEL_MAX];
+} top_entry;
+
+typedef struct top_heap {
+    top_entry *entries;
+    size_t count;
+    size_t size;
+} top_heap;
+
+int top_init(top_heap *h, size_t size);
+void top_add(top_heap *h, double value, const char *label);
+void top_sort(top_heap *h);
+void top_free(top_heap *h);
+
+#endif /* __SKETCH_H__ */
@@ -16,13 +16,12 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
-#include <ldns/ldns.h>
-
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
 
 #include "starttls.h"
+#include "trace.h"
 
 extern int debug;
 
@@ -51,6 +50,8 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	/* consume greeting (possibly multiline) & inspect reply code */
 	while (1) {
 	    read_len = BIO_gets(fbio, buffer, MYBUFSIZE);
+	    if (read_len > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
 	    (void) sscanf(buffer, "%3d", &reply_code);
 	    if (debug) {
 		cp = strstr(buffer, "\r\n");
@@ -72,9 +73,12 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	    fprintf(stdout, "send: EHLO %s\n", myhostname);
 	}
 	BIO_printf(fbio, "EHLO %s\r\n", myhostname);
+	TRACE2(starttls_send, hostname, "EHLO");
 	(void)BIO_flush(fbio);
 	while (1) {
 	    read_len = BIO_gets(fbio, buffer, MYBUFSIZE);
+	    if (read_len > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
 	    (void) sscanf(buffer, "%3d", &reply_code);
 	    (void) sscanf(buffer+4, "%255s", param);
 	    if (strcmp(param, "STARTTLS") == 0)
@@ -95,7 +99,10 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 		fprintf(stdout, "send: STARTTLS\n");
 	    }
 	    BIO_printf(sbio, "STARTTLS\r\n");
-            BIO_read(sbio, buffer, MYBUFSIZE);
+	    TRACE2(starttls_send, hostname, "STARTTLS");
+            read_len = BIO_read(sbio, buffer, MYBUFSIZE);
+	    if (read_len > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
 	    if (debug) {
 		cp = strstr(buffer, "\r\n");
 		*cp = '\0';
@@ -117,7 +124,9 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	int seen_starttls = 0;
 	BIO *fbio = BIO_new(BIO_f_buffer());
 	BIO_push(fbio, sbio);
-	BIO_gets(fbio, buffer, MYBUFSIZE);
+	read_len = BIO_gets(fbio, buffer, MYBUFSIZE);
+	if (read_len > 0)
+	    TRACE2(starttls_recv, hostname, buffer);
 	if (debug) {
 	    cp = strstr(buffer, "\r\n");
 	    *cp = '\0';
@@ -125,9 +134,12 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	    fprintf(stdout, "send: . CAPABILITY\n");
 	}
 	BIO_printf(fbio, ". CAPABILITY\r\n");
+	TRACE2(starttls_send, hostname, ". CAPABILITY");
 	(void) BIO_flush(fbio);
 	while (1) {
 	    read_len = BIO_gets(fbio, buffer, MYBUFSIZE);
+	    if (read_len > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
             if (debug) {
                 cp = strstr(buffer, "\r\n");
                 *cp = '\0';
@@ -146,7 +158,10 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 		fprintf(stdout, "send: . STARTTLS\n");
 	    }
 	    BIO_printf(sbio, ". STARTTLS\r\n");
-	    BIO_read(sbio, buffer, MYBUFSIZE);
+	    TRACE2(starttls_send, hostname, ". STARTTLS");
+	    read_len = BIO_read(sbio, buffer, MYBUFSIZE);
+	    if (read_len > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
             if (debug) {
                 cp = strstr(buffer, "\r\n");
                 *cp = '\0';
@@ -162,7 +177,9 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	break;
     }
     case STARTTLS_POP3: {
-	BIO_read(sbio, buffer, MYBUFSIZE);
+	read_len = BIO_read(sbio, buffer, MYBUFSIZE);
+	if (read_len > 0)
+	    TRACE2(starttls_recv, hostname, buffer);
 	if (debug) {
 	    cp = strstr(buffer, "\r\n");
 	    *cp = '\0';
@@ -170,7 +187,10 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	    fprintf(stdout, "send: STLS\n");
 	}
 	BIO_printf(sbio, "STLS\r\n");
-	BIO_read(sbio, buffer, MYBUFSIZE);
+	TRACE2(starttls_send, hostname, "STLS");
+	read_len = BIO_read(sbio, buffer, MYBUFSIZE);
+	if (read_len > 0)
+	    TRACE2(starttls_recv, hostname, buffer);
 	if (debug) {
 	    cp = strstr(buffer, "\r\n");
 	    *cp = '\0';
@@ -197,11 +217,14 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	if (debug) {
 	    fprintf(stdout, "send: %s\n", buffer);
 	}
+	TRACE2(starttls_send, hostname, buffer);
 	BIO_printf(sbio, buffer);
 	while (1) {
 	    readn = BIO_read(sbio, buffer, MYBUFSIZE);
 	    if (readn == 0) break;
 	    buffer[readn] = '\0';
+	    if (readn > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
 	    if (debug) {
 		fprintf(stdout, "recv: %s\n", buffer);
 	    }
@@ -219,9 +242,12 @@ int do_starttls(enum APP_STARTTLS starttls, BIO *sbio,
 	    if (debug) {
 		fprintf(stdout, "send: %s\n", buffer);
 	    }
+	    TRACE2(starttls_send, hostname, buffer);
 	    BIO_printf(sbio, buffer);
 	    readn = BIO_read(sbio, buffer, MYBUFSIZE);
             buffer[readn] = '\0';
+	    if (readn > 0)
+	        TRACE2(starttls_recv, hostname, buffer);
 	    if (debug) {
 		fprintf(stdout, "recv: %s\n", buffer);
 	    }
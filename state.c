@@ -0,0 +1,295 @@
+/*
+ * state.c
+ *
+ * Persistent state file, and the policies that use it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "state.h"
+#include "common.h"
+
+#define STATE_LINE_MAX 8192
+
+typedef struct state_entry {
+    char *key;
+    char *value;		/* NULL if deleted */
+    int changed;		/* set or deleted by this run */
+    struct state_entry *next;
+} state_entry;
+
+static state_entry *state_list = NULL;
+
+
+/*
+ * state_find()
+ */
+
+state_entry *state_find(const char *key)
+{
+    state_entry *sp;
+
+    for (sp = state_list; sp != NULL; sp = sp->next) {
+	if (strcmp(sp->key, key) == 0)
+	    return sp;
+    }
+    return NULL;
+}
+
+
+/*
+ * state_append(): add sp at the tail of the list at headp.
+ */
+
+static void state_append(state_entry **headp, state_entry *sp)
+{
+    while (*headp != NULL)
+	headp = &(*headp)->next;
+    sp->next = NULL;
+    *headp = sp;
+    return;
+}
+
+
+/*
+ * state_take(): remove the entry for key from the list at headp, and
+ * return it (or NULL).
+ */
+
+static state_entry *state_take(state_entry **headp, const char *key)
+{
+    state_entry *sp;
+
+    for (; (sp = *headp) != NULL; headp = &sp->next) {
+	if (strcmp(sp->key, key) == 0) {
+	    *headp = sp->next;
+	    sp->next = NULL;
+	    return sp;
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ * state_delete(): remove key, if present. The entry is kept, without
+ * a value, so that saving the state also removes it from the file.
+ */
+
+void state_delete(const char *key)
+{
+    state_entry *sp;
+
+    if ((sp = state_find(key)) != NULL) {
+	free(sp->value);
+	sp->value = NULL;
+	sp->changed = 1;
+    }
+    return;
+}
+
+
+/*
+ * state_get(): return the value stored for key, or NULL.
+ */
+
+const char *state_get(const char *key)
+{
+    state_entry *sp = state_find(key);
+    return sp ? sp->value : NULL;
+}
+
+
+/*
+ * state_set(): store value for key, replacing any previous value.
+ * New keys are added at the end, so that the file keeps its order.
+ */
+
+void state_set(const char *key, const char *value)
+{
+    state_entry *sp;
+
+    if ((sp = state_find(key)) == NULL) {
+	sp = (state_entry *) calloc(1, sizeof(state_entry));
+	sp->key = strdup(key);
+	state_append(&state_list, sp);
+    }
+    free(sp->value);
+    sp->value = strdup(value);
+    sp->changed = 1;
+    return;
+}
+
+
+/*
+ * state_merge(): read the state file into the list. Entries set or
+ * deleted by this run keep their value; all others take the value
+ * in the file, which another run may have changed since ours was
+ * loaded, and entries no longer in the file are dropped unless this
+ * run set them. The list follows the order of the file, with new
+ * entries at the end. A missing file is not an error
+ * (there is no state before the first run). Returns 0 on failure.
+ */
+
+static int state_merge(const char *path)
+{
+    FILE *fp;
+    char line[STATE_LINE_MAX], *cp;
+    state_entry *merged = NULL, *sp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return 1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	line[strcspn(line, "\n")] = '\0';
+	if ((cp = strchr(line, '\t')) == NULL)
+	    continue;
+	*cp++ = '\0';
+	if ((sp = state_take(&state_list, line)) == NULL) {
+	    sp = (state_entry *) calloc(1, sizeof(state_entry));
+	    sp->key = strdup(line);
+	}
+	if (!sp->changed) {
+	    free(sp->value);
+	    sp->value = strdup(cp);
+	}
+	state_append(&merged, sp);
+    }
+    fclose(fp);
+
+    /* entries only this run has set; the others were deleted */
+    while ((sp = state_list) != NULL) {
+	state_list = sp->next;
+	if (sp->changed) {
+	    state_append(&merged, sp);
+	} else {
+	    free(sp->key);
+	    free(sp->value);
+	    free(sp);
+	}
+    }
+    state_list = merged;
+    return 1;
+}
+
+
+/*
+ * state_load(): read the state file.
+ */
+
+int state_load(const char *path)
+{
+    return state_merge(path);
+}
+
+
+/*
+ * state_save(): write the state file. Runs sharing a state file may
+ * be concurrent, so the save is done under an exclusive lock on
+ * <path>.lock: the file is read again and merged with this run's
+ * changes, so that the entries other runs saved meanwhile are kept.
+ * The new contents are written to a temporary file which then
+ * replaces the old one, so that an interrupted run cannot leave a
+ * truncated state file behind.
+ */
+
+int state_save(const char *path)
+{
+    FILE *fp;
+    char tmppath[STATE_LINE_MAX], lockpath[STATE_LINE_MAX];
+    state_entry *sp;
+    int lockfd, rc = 0;
+
+    snprintf(lockpath, sizeof(lockpath), "%s.lock", path);
+    if ((lockfd = open(lockpath, O_RDWR | O_CREAT, 0644)) == -1 ||
+	flock(lockfd, LOCK_EX) == -1) {
+	fprintf(stderr, "Unable to lock state file %s.\n", lockpath);
+	if (lockfd != -1)
+	    close(lockfd);
+	return 0;
+    }
+
+    (void) state_merge(path);
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    if ((fp = fopen(tmppath, "w")) == NULL) {
+	fprintf(stderr, "Unable to write state file %s.\n", tmppath);
+	goto cleanup;
+    }
+    for (sp = state_list; sp != NULL; sp = sp->next) {
+	if (sp->value != NULL)
+	    fprintf(fp, "%s\t%s\n", sp->key, sp->value);
+    }
+    if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+	fprintf(stderr, "Unable to write state file %s.\n", path);
+	goto cleanup;
+    }
+    rc = 1;
+
+cleanup:
+    close(lockfd);
+    return rc;
+}
+
+
+/*
+ * breaker_open(): return 1 if the circuit breaker for address and port
+ * is open, i.e. the peer should not be probed.
+ */
+
+int breaker_open(const char *address, uint16_t port)
+{
+    char key[STATE_LINE_MAX];
+    const char *value;
+    int failures = 0;
+    long long last = 0;
+
+    if (state_file == NULL || breaker_threshold <= 0)
+	return 0;
+
+    snprintf(key, sizeof(key), "breaker %s %d", address, port);
+    if ((value = state_get(key)) == NULL ||
+	sscanf(value, "%d %lld", &failures, &last) != 2)
+	return 0;
+
+    return (failures >= breaker_threshold &&
+	    (long long) time(NULL) < last + breaker_cooldown);
+}
+
+
+/*
+ * breaker_update(): record the outcome of a connection attempt.
+ * A successful connection closes the breaker again (and forgets the
+ * peer, so that the state file only holds failing addresses).
+ */
+
+void breaker_update(const char *address, uint16_t port, int connected)
+{
+    char key[STATE_LINE_MAX], value[64];
+    const char *old;
+    int failures = 0;
+    long long last = 0;
+
+    if (state_file == NULL || breaker_threshold <= 0)
+	return;
+
+    snprintf(key, sizeof(key), "breaker %s %d", address, port);
+    if (connected) {
+	state_delete(key);
+	return;
+    }
+    if ((old = state_get(key)) != NULL)
+	(void) sscanf(old, "%d %lld", &failures, &last);
+    failures++;
+    last = (long long) time(NULL);
+    snprintf(value, sizeof(value), "%d %lld", failures, last);
+    state_set(key, value);
+    return;
+}
@@ -0,0 +1,29 @@
+#ifndef __STATE_H__
+#define __STATE_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Persistent state kept across runs in a state file (--state). Each
+ * line holds a key and a value separated by a tab. Keys start with
+ * the name of the feature that owns them.
+ */
+
+int state_load(const char *path);
+int state_save(const char *path);
+const char *state_get(const char *key);
+void state_set(const char *key, const char *value);
+void state_delete(const char *key);
+
+/*
+ * Circuit breaker per peer address and port: after breaker_threshold
+ * consecutive connection failures, the address is skipped until
+ * breaker_cooldown seconds have passed since the last failure.
+ */
+
+int breaker_open(const char *address, uint16_t port);
+void breaker_update(const char *address, uint16_t port, int connected);
+
+#endif /* __STATE_H__ */
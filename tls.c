@@ -8,7 +8,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -22,6 +25,12 @@
 #include "starttls.h"
 #include "tls.h"
 #include "utils.h"
+#include "state.h"
+#include "trace.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+#error "OpenSSL 1.1.1 or later is required (BIO_set_callback_ex)"
+#endif
 
 /*
  * print_cert_chain()
@@ -101,27 +110,272 @@ void print_validated_chain(SSL *ssl)
 
 
 /*
- * do_tls()
- *
+ * Result callbacks: called with the outcome of each peer checked by
+ * do_tls(), once that peer is done, in the order they were added.
+ * The result (and the strings it points to) is only valid for the
+ * duration of the call.
  */
 
-int do_tls(const char *hostname,
-	   struct addrinfo *addresses, tlsa_rdata *tlsa_rdata_list)
+#define MAX_RESULT_CALLBACKS 4
+
+struct {
+    tls_result_cb callback;
+    void *userarg;
+} tls_result_callbacks[MAX_RESULT_CALLBACKS];
+int tls_result_callback_count = 0;
+
+int add_tls_result_callback(tls_result_cb callback, void *userarg)
 {
-    struct addrinfo *gaip = NULL;
-    char ipstring[INET6_ADDRSTRLEN], *cp;
-    struct sockaddr_in *sa4;
-    struct sockaddr_in6 *sa6;
-    int count_success = 0, count_fail = 0, count_tlsa_usable = 0;
-    int rc, sock;
-    long rcl;
+    if (tls_result_callback_count >= MAX_RESULT_CALLBACKS)
+	return 0;
+    tls_result_callbacks[tls_result_callback_count].callback = callback;
+    tls_result_callbacks[tls_result_callback_count].userarg = userarg;
+    tls_result_callback_count++;
+    return 1;
+}
 
-    SSL_CTX *ctx = NULL;
-    SSL *ssl = NULL;
-    const SSL_CIPHER *cipher = NULL;
-    BIO *sbio;
+void remove_tls_result_callback(tls_result_cb callback)
+{
+    int i, j;
+
+    for (i = 0; i < tls_result_callback_count; i++) {
+	if (tls_result_callbacks[i].callback == callback) {
+	    for (j = i + 1; j < tls_result_callback_count; j++)
+		tls_result_callbacks[j-1] = tls_result_callbacks[j];
+	    tls_result_callback_count--;
+	    return;
+	}
+    }
+    return;
+}
 
-    uint8_t usage, selector, mtype;
+
+/*
+ * deliver_result()
+ * Record the failure stage (NULL on success) and pass the result of
+ * a peer to the result callbacks.
+ */
+
+void deliver_result(tls_result *result, const char *error)
+{
+    int i;
+
+    result->error = error;
+    TRACE4(verdict, result->hostname, result->address,
+	   result->authenticated, error);
+    for (i = 0; i < tls_result_callback_count; i++)
+	tls_result_callbacks[i].callback(result,
+					 tls_result_callbacks[i].userarg);
+    return;
+}
+
+
+/*
+ * count_io()
+ * Callback on the socket BIO: add the bytes read and written to the
+ * tls_io that is set as the callback argument, if any.
+ */
+
+long count_io(BIO *b, int oper, const char *argp, size_t len, int argi,
+	      long argl, int ret, size_t *processed)
+{
+    tls_io *io = (tls_io *) BIO_get_callback_arg(b);
+
+    (void) argp; (void) len; (void) argi; (void) argl;
+    if (io == NULL || ret <= 0 || processed == NULL)
+	return ret;
+
+    switch (oper) {
+    case BIO_CB_READ | BIO_CB_RETURN:
+    case BIO_CB_GETS | BIO_CB_RETURN:
+	if (io->last_was_write)
+	    io->round_trips++;
+	io->last_was_write = 0;
+	io->bytes_received += *processed;
+	break;
+    case BIO_CB_WRITE | BIO_CB_RETURN:
+    case BIO_CB_PUTS | BIO_CB_RETURN:
+	io->last_was_write = 1;
+	io->bytes_sent += *processed;
+	break;
+    default:
+	break;
+    }
+    return ret;
+}
+
+
+/*
+ * print_io()
+ */
+
+void print_io(const char *phase, tls_io *io)
+{
+    fprintf(stdout, "%s: %zu bytes sent, %zu bytes received, "
+	    "%d round trips\n", phase, io->bytes_sent, io->bytes_received,
+	    io->round_trips);
+    return;
+}
+
+
+/*
+ * cert_fingerprint()
+ * Compute the SHA-256 fingerprint of the peer's end entity certificate
+ * as a hex string in buf (which must hold 2 * SHA256_DIGEST_LENGTH + 1).
+ */
+
+void cert_fingerprint(SSL *ssl, char *buf)
+{
+    X509 *cert;
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len = 0;
+    char *cp;
+
+    buf[0] = '\0';
+    if ((cert = SSL_get_peer_certificate(ssl)) == NULL)
+	return;
+    if (X509_digest(cert, EVP_sha256(), md, &md_len)) {
+	cp = bin2hexstring(md, md_len);
+	strcpy(buf, cp);
+	free(cp);
+    }
+    X509_free(cert);
+    return;
+}
+
+
+/*
+ * Additional reference identifiers: names other than the hostname
+ * passed to do_tls() that are acceptable in the peer certificate.
+ */
+
+#define MAX_REFERENCE_NAMES 16
+
+const char *reference_names[MAX_REFERENCE_NAMES];
+int reference_name_count = 0;
+
+int add_reference_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < reference_name_count; i++) {
+	if (same_domain_name(reference_names[i], name))
+	    return 1;
+    }
+    if (reference_name_count >= MAX_REFERENCE_NAMES) {
+	fprintf(stdout, "Too many reference names, ignoring: %s\n", name);
+	return 0;
+    }
+    reference_names[reference_name_count++] = name;
+    return 1;
+}
+
+
+/*
+ * add_reference_names(): accept the additional reference identifiers
+ * in the peer certificate of ssl. Returns 0 if any of them failed.
+ */
+
+int add_reference_names(SSL *ssl)
+{
+    int i, rc = 1;
+
+    for (i = 0; i < reference_name_count; i++) {
+	if (SSL_add1_host(ssl, reference_names[i]) != 1) {
+	    fprintf(stdout, "SSL_add1_host() failed: %s\n",
+		    reference_names[i]);
+	    ERR_print_errors_fp(stdout);
+	    rc = 0;
+	}
+    }
+    return rc;
+}
+
+
+/*
+ * tls_base_name: TLSA base domain, when it is not the hostname passed
+ * to do_tls() (i.e. the TLSA records in use are those at the CNAME-
+ * expanded name). It is then sent as SNI and is the primary reference
+ * identifier, while the hostname is still used for the STARTTLS
+ * conversation and in the results.
+ */
+
+const char *tls_base_name = NULL;
+
+const char *tls_peer_name(const char *hostname)
+{
+    return tls_base_name ? tls_base_name : hostname;
+}
+
+
+/*
+ * connect_timeout()
+ * connect() with an upper bound of timeout seconds (no bound if 0).
+ * The socket is left in blocking mode, with send and receive timeouts
+ * of the same length, so that a stalled peer cannot hold up the
+ * STARTTLS conversation or the TLS handshake indefinitely either.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+
+int connect_timeout(int sock, struct sockaddr *addr, socklen_t addrlen,
+		    int timeout)
+{
+    int flags, rc, err = 0;
+    socklen_t errlen = sizeof(err);
+    struct pollfd pfd;
+    struct timeval tv;
+
+    if (timeout <= 0)
+	return connect(sock, addr, addrlen);
+
+    if ((flags = fcntl(sock, F_GETFL, 0)) == -1 ||
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+	return -1;
+
+    rc = connect(sock, addr, addrlen);
+    if (rc == -1 && errno == EINPROGRESS) {
+	pfd.fd = sock;
+	pfd.events = POLLOUT;
+	do {
+	    rc = poll(&pfd, 1, timeout * 1000);
+	} while (rc == -1 && errno == EINTR);
+	if (rc == 0) {
+	    errno = ETIMEDOUT;
+	    return -1;
+	} else if (rc == -1)
+	    return -1;
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+	    return -1;
+	if (err != 0) {
+	    errno = err;
+	    return -1;
+	}
+    } else if (rc == -1)
+	return -1;
+
+    if (fcntl(sock, F_SETFL, flags) == -1)
+	return -1;
+
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    (void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return 0;
+}
+
+
+/*
+ * new_tls_context()
+ * Create a TLS client context from the current configuration (CA file
+ * and DANE flags). Each SSL object created from it holds a reference
+ * to it, so a caller may build a replacement context after a
+ * configuration change and free the old one while connections made
+ * from it are still in progress. Returns NULL on failure.
+ */
+
+SSL_CTX *new_tls_context(void)
+{
+    SSL_CTX *ctx = NULL;
 
     /*
      * Initialize OpenSSL TLS library context, certificate authority
@@ -131,21 +385,27 @@ int do_tls(const char *hostname,
     SSL_load_error_strings();
     SSL_library_init();
 
-    ctx = SSL_CTX_new(TLS_client_method());
+    if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL) {
+	fprintf(stdout, "SSL_CTX_new() failed.\n");
+	ERR_print_errors_fp(stdout);
+	return NULL;
+    }
     (void) SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3);
 
     if (!CAfile) {
 	if (!SSL_CTX_set_default_verify_paths(ctx)) {
 	    fprintf(stdout, "Failed to load default certificate authorities.\n");
 	    ERR_print_errors_fp(stdout);
-	    goto cleanup;
+	    SSL_CTX_free(ctx);
+	    return NULL;
 	}
     } else {
 	if (!SSL_CTX_load_verify_locations(ctx, CAfile, NULL)) {
 	    fprintf(stdout, "Failed to load certificate authority store: %s.\n",
 		    CAfile);
 	    ERR_print_errors_fp(stdout);
-	    goto cleanup;
+	    SSL_CTX_free(ctx);
+	    return NULL;
 	}
     }
 
@@ -158,7 +418,8 @@ int do_tls(const char *hostname,
 
     if (SSL_CTX_dane_enable(ctx) <= 0) {
 	fprintf(stdout, "Unable to enable DANE on SSL context.\n");
-	goto cleanup;
+	SSL_CTX_free(ctx);
+	return NULL;
     }
 
     /*
@@ -169,6 +430,46 @@ int do_tls(const char *hostname,
 	(void) SSL_CTX_dane_set_flags(ctx, DANE_FLAG_NO_DANE_EE_NAMECHECKS);
     }
 
+    return ctx;
+}
+
+
+/*
+ * do_tls()
+ *
+ */
+
+int do_tls(const char *hostname,
+	   struct addrinfo *addresses, tlsa_rdata *tlsa_rdata_list)
+{
+    struct addrinfo *gaip = NULL;
+    char ipstring[INET6_ADDRSTRLEN], *cp;
+    struct sockaddr_in *sa4;
+    struct sockaddr_in6 *sa6;
+    int count_success = 0, count_fail = 0, count_tlsa_usable = 0;
+    const char *peer_name = tls_peer_name(hostname);
+    int i, rc, sock;
+    long rcl;
+    uint64_t start;
+    tls_result result;
+
+    SSL_CTX *ctx = NULL;
+    SSL *ssl = NULL;
+    const SSL_CIPHER *cipher = NULL;
+    BIO *sbio;
+
+    uint8_t usage, selector, mtype;
+
+    if ((ctx = new_tls_context()) == NULL)
+	goto cleanup;
+
+    if (debug && reference_name_count > 0) {
+	fprintf(stdout, "Reference names: %s", peer_name);
+	for (i = 0; i < reference_name_count; i++)
+	    fprintf(stdout, ", %s", reference_names[i]);
+	fprintf(stdout, "\n\n");
+    }
+
     /*
      * Loop over all addresses, connect to each, establish TLS
      * connection, and perform peer authentication.
@@ -188,26 +489,52 @@ int do_tls(const char *hostname,
                     ipstring, ntohs(sa6->sin6_port));
         }
 
+	memset(&result, 0, sizeof(result));
+	result.hostname = hostname;
+	result.address = ipstring;
+	result.port = (gaip->ai_family == AF_INET6) ?
+	    ntohs(((struct sockaddr_in6 *) gaip->ai_addr)->sin6_port) :
+	    ntohs(((struct sockaddr_in *) gaip->ai_addr)->sin_port);
+	result.dane_depth = -1;
+
+	if (breaker_open(ipstring, result.port)) {
+	    fprintf(stdout, "Skipped: circuit breaker open for this address.\n");
+	    count_fail++;
+	    deliver_result(&result, "skipped-breaker-open");
+	    continue;
+	}
+
         sock = socket(gaip->ai_family, SOCK_STREAM, IPPROTO_TCP);
         if (sock == -1) {
             fprintf(stdout, "socket setup failed: %s\n", strerror(errno));
 	    count_fail++;
+	    deliver_result(&result, "socket");
             continue;
         }
 
-        if (connect(sock, gaip->ai_addr, gaip->ai_addrlen) == -1) {
+	TRACE2(connect_start, hostname, ipstring);
+	start = now_usec();
+	rc = connect_timeout(sock, gaip->ai_addr, gaip->ai_addrlen, timeout);
+	result.connect_usec = now_usec() - start;
+	TRACE3(connect_end, hostname, ipstring, rc);
+        if (rc == -1) {
             fprintf(stdout, "connect failed: %s\n", strerror(errno));
+	    breaker_update(ipstring, result.port, 0);
             close(sock);
 	    count_fail++;
+	    deliver_result(&result, "connect");
             continue;
         }
 
+	breaker_update(ipstring, result.port, 1);
+
 	ssl = SSL_new(ctx);
 	if (!ssl) {
 	    fprintf(stdout, "SSL_new() failed.\n");
 	    ERR_print_errors_fp(stdout);
 	    close(sock);
 	    count_fail++;
+	    deliver_result(&result, "ssl-new");
 	    continue;
 	}
 
@@ -219,30 +546,35 @@ int do_tls(const char *hostname,
 
 	if (attempt_dane) {
 
-	    if (SSL_dane_enable(ssl, hostname) <= 0) {
+	    if (SSL_dane_enable(ssl, peer_name) <= 0) {
 		fprintf(stdout, "SSL_dane_enable() failed.\n");
 		ERR_print_errors_fp(stdout);
 		SSL_free(ssl);
 		close(sock);
 		count_fail++;
+		deliver_result(&result, "dane-enable");
 		continue;
 	    }
 
 	} else {
 
-	    if (SSL_set1_host(ssl, hostname) != 1) {
+	    if (SSL_set1_host(ssl, peer_name) != 1) {
 		fprintf(stdout, "SSL_set1_host() failed.\n");
 		ERR_print_errors_fp(stdout);
 		SSL_free(ssl);
 		close(sock);
 		count_fail++;
+		deliver_result(&result, "set1-host");
 		continue;
 	    }
 	    /* Set TLS Server Name Indication extension */
-	    (void) SSL_set_tlsext_host_name(ssl, hostname);
+	    (void) SSL_set_tlsext_host_name(ssl, peer_name);
 
 	}
 
+	/* Also accept any additional reference identifiers */
+	(void) add_reference_names(ssl);
+
 	/* No partial label wildcards */
 	SSL_set_hostflags(ssl, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
 
@@ -250,6 +582,8 @@ int do_tls(const char *hostname,
 	SSL_set_connect_state(ssl);
         sbio = BIO_new_socket(sock, BIO_NOCLOSE);
 	SSL_set_bio(ssl, sbio, sbio);
+	BIO_set_callback_ex(sbio, count_io);
+	BIO_set_callback_arg(sbio, (char *) &result.starttls_io);
 	(void) SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
 
 	/* Add TLSA record set rdata to TLS connection context */
@@ -280,26 +614,41 @@ int do_tls(const char *hostname,
 	    SSL_free(ssl);
 	    close(sock);
 	    count_fail++;
+	    deliver_result(&result, "no-usable-tlsa");
 	    continue;
 	}
 
 	/* Do application specific STARTTLS conversation if requested */
-	if (starttls != STARTTLS_NONE && !do_starttls(starttls, sbio, service_name, hostname)) {
-	    fprintf(stdout, "STARTTLS failed.\n");
-	    /* shutdown sbio here cleanly */
-	    SSL_free(ssl);
-	    close(sock);
-	    count_fail++;
-	    continue;
+	if (starttls != STARTTLS_NONE) {
+	    start = now_usec();
+	    rc = do_starttls(starttls, sbio, service_name, hostname);
+	    result.starttls_usec = now_usec() - start;
+	    if (!rc) {
+		fprintf(stdout, "STARTTLS failed.\n");
+		/* shutdown sbio here cleanly */
+		SSL_free(ssl);
+		close(sock);
+		count_fail++;
+		deliver_result(&result, "starttls");
+		continue;
+	    }
 	}
 
 	/* Perform TLS connection handshake & peer authentication */
-	if (SSL_connect(ssl) <= 0) {
+	BIO_set_callback_arg(sbio, (char *) &result.handshake_io);
+	TRACE2(handshake_start, hostname, ipstring);
+	start = now_usec();
+	rc = SSL_connect(ssl);
+	result.handshake_usec = now_usec() - start;
+	BIO_set_callback_arg(sbio, NULL);
+	TRACE3(handshake_end, hostname, ipstring, rc);
+	if (rc <= 0) {
 	    fprintf(stdout, "TLS connection failed.\n");
 	    ERR_print_errors_fp(stdout);
 	    SSL_free(ssl);
 	    close(sock);
 	    count_fail++;
+	    deliver_result(&result, "handshake");
 	    continue;
 	}
 
@@ -307,14 +656,24 @@ int do_tls(const char *hostname,
 	cipher = SSL_get_current_cipher(ssl);
 	fprintf(stdout, "Cipher: %s %s\n",
 		SSL_CIPHER_get_version(cipher), SSL_CIPHER_get_name(cipher));
+	if (debug) {
+	    if (starttls != STARTTLS_NONE)
+		print_io("STARTTLS", &result.starttls_io);
+	    print_io("Handshake", &result.handshake_io);
+	}
+	result.tls_version = SSL_get_version(ssl);
+	result.cipher = SSL_CIPHER_get_name(cipher);
+	cert_fingerprint(ssl, result.cert_sha256);
 
 	/* Print Certificate Chain information (if in debug mode) */
 	if (debug)
 	    print_peer_cert_chain(ssl);
 
 	/* Report results of DANE or PKIX authentication of peer cert */
-	if ((rcl = SSL_get_verify_result(ssl)) == X509_V_OK) {
+	result.verify_rc = rcl = SSL_get_verify_result(ssl);
+	if (rcl == X509_V_OK) {
 	    count_success++;
+	    result.authenticated = 1;
 	    const unsigned char *certdata;
 	    size_t certdata_len;
 	    const char *peername = SSL_get0_peername(ssl);
@@ -323,6 +682,12 @@ int do_tls(const char *hostname,
 	    if (depth >= 0) {
 		(void) SSL_get0_dane_tlsa(ssl, &usage, &selector, &mtype, 
 					  &certdata, &certdata_len);
+		result.dane_depth = depth;
+		result.usage = usage;
+		result.selector = selector;
+		result.mtype = mtype;
+		result.tlsa_data = certdata;
+		result.tlsa_data_len = certdata_len;
 		fprintf(stdout, "DANE TLSA %d %d %d [%s...] %s at depth %d\n", 
 			usage, selector, mtype,
 			(cp = bin2hexstring( (uint8_t *) certdata, 6)),
@@ -332,9 +697,13 @@ int do_tls(const char *hostname,
 		free(cp);
 	    }
 	    if (peername != NULL) {
-		/* Name checks were in scope and matched the peername */
+		/*
+		 * Name checks were in scope and matched the peername;
+		 * with several reference names, this tells which one.
+		 */
 		fprintf(stdout, "Verified peername: %s\n", peername);
 	    }
+	    result.peername = peername;
 	    /* Print verified certificate chain (if in debug mode) */
 	    if (debug)
 		print_validated_chain(ssl);
@@ -358,6 +727,7 @@ int do_tls(const char *hostname,
 	/* Shutdown our end and exit (don't wait for peer shutdown) */
 	SSL_shutdown(ssl);
 
+	deliver_result(&result, result.authenticated ? NULL : "verify");
 	SSL_free(ssl);
 	close(sock);
 	(void) fputc('\n', stdout);
@@ -366,6 +736,9 @@ int do_tls(const char *hostname,
 
 cleanup:
 
+    if (ctx)
+	SSL_CTX_free(ctx);
+
     /*
      * Return status:
      * 0: Authentication success for all queried peers
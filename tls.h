@@ -3,9 +3,61 @@
 
 #include "tlsardata.h"
 
+/*
+ * tls_io: bytes exchanged with the peer during one phase of the
+ * connection, and the number of round trips: times that data was
+ * read after something had been written.
+ */
+
+typedef struct tls_io {
+    size_t bytes_sent;
+    size_t bytes_received;
+    int round_trips;
+    int last_was_write;
+} tls_io;
+
+/*
+ * tls_result: structured outcome of the TLS session with one peer
+ * address, as reported by do_tls().
+ */
+
+typedef struct tls_result {
+    const char *hostname;
+    const char *address;
+    uint16_t port;
+    const char *error;          /* failure stage, NULL on success */
+    int authenticated;          /* peer authentication succeeded */
+    long verify_rc;             /* X509 verification result */
+    const char *tls_version;
+    const char *cipher;
+    char cert_sha256[65];       /* end entity certificate fingerprint */
+    int dane_depth;             /* depth of DANE match, -1 if none */
+    uint8_t usage, selector, mtype;
+    const unsigned char *tlsa_data;
+    size_t tlsa_data_len;
+    const char *peername;       /* matched reference identifier */
+    tls_io starttls_io;         /* STARTTLS conversation */
+    tls_io handshake_io;        /* TLS handshake */
+    uint64_t connect_usec;      /* time taken by each phase */
+    uint64_t starttls_usec;
+    uint64_t handshake_usec;
+} tls_result;
+
+typedef void (*tls_result_cb)(tls_result *result, void *userarg);
+
+int add_tls_result_callback(tls_result_cb callback, void *userarg);
+void remove_tls_result_callback(tls_result_cb callback);
+
 void print_cert_chain(STACK_OF(X509) *chain);
 void print_peer_cert_chain(SSL *ssl);
 void print_validated_chain(SSL *ssl);
+int add_reference_name(const char *name);
+int add_reference_names(SSL *ssl);
+extern const char *tls_base_name;
+const char *tls_peer_name(const char *hostname);
+int connect_timeout(int sock, struct sockaddr *addr, socklen_t addrlen,
+		    int timeout);
+SSL_CTX *new_tls_context(void);
 int do_tls(const char *hostname, struct addrinfo *addresses, tlsa_rdata *tlsa_rdata_list);
 
 #endif /* __TLS_H__ */
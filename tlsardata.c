@@ -3,8 +3,10 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 
-#include "query-ldns.h"
+#include "tlsardata.h"
 #include "utils.h"
 #include "common.h"
 
@@ -31,7 +33,7 @@ void free_tlsa(tlsa_rdata *head)
 
     while ((current = head) != NULL) {
 	head = head->next;
-	LDNS_FREE(current->data);
+	free(current->data);
 	free(current);
     }
     return;
@@ -48,7 +50,7 @@ void print_tlsa(tlsa_rdata *tlist)
     tlsa_rdata *rp;
 
     if (tlist) {
-        fprintf(stdout, "\nTLSA records found: %ld\n", tlsa_count);
+        fprintf(stdout, "\nTLSA records found: %zu\n", tlsa_count);
         for (rp = tlist; rp != NULL; rp = rp->next) {
             fprintf(stdout, "TLSA: %d %d %d %s\n", rp->usage, rp->selector,
                     rp->mtype, (cp = bin2hexstring(rp->data, rp->data_len)));
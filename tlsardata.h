@@ -28,4 +28,10 @@ void free_tlsa(tlsa_rdata *head);
 
 void print_tlsa(tlsa_rdata *tlist);
 
+/*
+ * tlsa_count: count of TLSA records, set by the DNS query code.
+ */
+
+extern size_t tlsa_count;
+
 #endif /* __TLSASTRUCT_H__ */
@@ -0,0 +1,65 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Statically defined (USDT) tracepoints for bpftrace, perf and
+ * systemtap, under the provider name "danetls". For example:
+ *
+ *   bpftrace -e 'usdt:/usr/local/bin/danetls:danetls:verdict
+ *       { printf("%s %s %d\n", str(arg0), str(arg1), arg2); }'
+ *
+ * A probe that is not being traced is a single nop instruction. The
+ * probes are compiled in when <sys/sdt.h> (systemtap-sdt-dev) is
+ * available, unless built with -DNO_USDT. The same tracepoints feed
+ * the --trace-file timeline.
+ *
+ * Probes and arguments:
+ *   dns_submit      qname, qtype
+ *   dns_complete    qname, qtype, answered (0/1)
+ *   connect_start   target, address
+ *   connect_end     target, address, rc (0 or -1)
+ *   starttls_send   target, command
+ *   starttls_recv   target, response line
+ *   handshake_start target, address
+ *   handshake_end   target, address, SSL_connect() return value
+ *   verdict         target, address, authenticated (0/1), error stage
+ */
+
+#include "tracefile.h"
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define USDT2(name, a, b)		DTRACE_PROBE2(danetls, name, a, b)
+#define USDT3(name, a, b, c)		DTRACE_PROBE3(danetls, name, a, b, c)
+#define USDT4(name, a, b, c, d)		DTRACE_PROBE4(danetls, name, a, b, c, d)
+#else
+#define USDT2(name, a, b)		do { } while (0)
+#define USDT3(name, a, b, c)		do { } while (0)
+#define USDT4(name, a, b, c, d)		do { } while (0)
+#endif
+
+/*
+ * Each tracepoint also writes the corresponding event to the trace
+ * file (see tracefile.c), when one is open.
+ */
+
+#define TRACE2(name, a, b) do {						\
+	USDT2(name, a, b);						\
+	if (trace_fp) trace_##name(a, b);				\
+    } while (0)
+#define TRACE3(name, a, b, c) do {					\
+	USDT3(name, a, b, c);						\
+	if (trace_fp) trace_##name(a, b, c);				\
+    } while (0)
+#define TRACE4(name, a, b, c, d) do {					\
+	USDT4(name, a, b, c, d);					\
+	if (trace_fp) trace_##name(a, b, c, d);				\
+    } while (0)
+
+#endif /* __TRACE_H__ */
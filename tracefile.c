@@ -0,0 +1,237 @@
+/*
+ * tracefile.c
+ *
+ * Write a timeline of one check to a trace file in the Chrome trace
+ * event format: DNS queries as async spans (they overlap), and for
+ * each peer a span containing the connect, STARTTLS and handshake
+ * spans, with STARTTLS commands and responses as instant events.
+ *
+ * The file is opened for appending and written in the JSON array form
+ * without the closing bracket, which trace viewers accept, so that a
+ * sweep of many targets can share one file. Each run shows up as its
+ * own process, named after the target.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+
+#include "tracefile.h"
+#include "starttls.h"
+#include "utils.h"
+
+#define MAX_LINE 512
+
+FILE *trace_fp = NULL;
+
+static int peer_open = 0;
+static const char *phase_open = NULL;
+
+
+/*
+ * json_string(): write s as a JSON string.
+ */
+
+void json_string(FILE *fp, const char *s)
+{
+    const unsigned char *cp;
+
+    fputc('"', fp);
+    for (cp = (const unsigned char *) s; cp && *cp; cp++) {
+	if (*cp == '"' || *cp == '\\')
+	    fprintf(fp, "\\%c", *cp);
+	else if (*cp < 0x20)
+	    fprintf(fp, "\\u%04x", *cp);
+	else
+	    fputc(*cp, fp);
+    }
+    fputc('"', fp);
+    return;
+}
+
+
+/*
+ * trace_event(): write one event of type ph ("B", "E", "b", "e", "i")
+ * with an optional async id and one optional string argument.
+ */
+
+void trace_event(const char *ph, const char *cat, const char *name,
+		 const char *id, const char *argname, const char *argvalue)
+{
+    fprintf(trace_fp, "{\"ph\":\"%s\",\"cat\":\"%s\",\"name\":", ph, cat);
+    json_string(trace_fp, name);
+    fprintf(trace_fp, ",\"ts\":%llu,\"pid\":%d,\"tid\":1",
+	    (unsigned long long) now_usec(), (int) getpid());
+    if (id) {
+	fprintf(trace_fp, ",\"id\":");
+	json_string(trace_fp, id);
+    }
+    if (*ph == 'i')
+	fprintf(trace_fp, ",\"s\":\"t\"");
+    if (argname) {
+	fprintf(trace_fp, ",\"args\":{\"%s\":", argname);
+	json_string(trace_fp, argvalue);
+	fputc('}', trace_fp);
+    }
+    fprintf(trace_fp, "},\n");
+    return;
+}
+
+
+/*
+ * trace_open(): start tracing this check of hostname to path, for a
+ * sample fraction of runs. Returns 0 if the file cannot be opened.
+ */
+
+int trace_open(const char *path, const char *hostname, double sample)
+{
+    if (sample < 1.0) {
+	srandom((unsigned int) (now_usec() ^ getpid()));
+	if (random() >= sample * RAND_MAX)
+	    return 1;
+    }
+
+    if ((trace_fp = fopen(path, "a")) == NULL) {
+	fprintf(stderr, "Unable to open trace file %s.\n", path);
+	return 0;
+    }
+    setvbuf(trace_fp, NULL, _IOLBF, 0);
+    if (ftell(trace_fp) == 0)
+	fprintf(trace_fp, "[\n");
+
+    fprintf(trace_fp, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+	    "\"args\":{\"name\":", (int) getpid());
+    json_string(trace_fp, hostname);
+    fprintf(trace_fp, "}},\n");
+    trace_event("B", "check", hostname, NULL, NULL, NULL);
+    return 1;
+}
+
+
+/*
+ * trace_close(): end the check span and close the trace file.
+ */
+
+void trace_close(void)
+{
+    if (trace_fp == NULL)
+	return;
+    trace_event("E", "check", "", NULL, NULL, NULL);
+    fclose(trace_fp);
+    trace_fp = NULL;
+    return;
+}
+
+
+/*
+ * DNS queries: async spans, identified by query name and type.
+ */
+
+void trace_dns_submit(const char *qname, int qtype)
+{
+    char name[512];
+
+    snprintf(name, sizeof(name), "%s/%d", qname, qtype);
+    trace_event("b", "dns", name, name, NULL, NULL);
+    return;
+}
+
+void trace_dns_complete(const char *qname, int qtype, int answered)
+{
+    char name[512];
+
+    snprintf(name, sizeof(name), "%s/%d", qname, qtype);
+    trace_event("e", "dns", name, name, "answered", answered ? "yes" : "no");
+    return;
+}
+
+
+/*
+ * Peers: a span per address, containing the connect, starttls and
+ * handshake phase spans.
+ */
+
+void trace_phase_begin(const char *phase)
+{
+    trace_event("B", "tls", phase, NULL, NULL, NULL);
+    phase_open = phase;
+    return;
+}
+
+void trace_phase_end(void)
+{
+    if (phase_open) {
+	trace_event("E", "tls", phase_open, NULL, NULL, NULL);
+	phase_open = NULL;
+    }
+    return;
+}
+
+void trace_connect_start(const char *target, const char *address)
+{
+    (void) target;
+    trace_event("B", "tls", address, NULL, NULL, NULL);
+    peer_open = 1;
+    trace_phase_begin("connect");
+    return;
+}
+
+void trace_connect_end(const char *target, const char *address, int rc)
+{
+    (void) target; (void) address;
+    trace_phase_end();
+    if (rc == 0 && starttls != STARTTLS_NONE)
+	trace_phase_begin("starttls");
+    return;
+}
+
+void trace_starttls_send(const char *target, const char *command)
+{
+    (void) target;
+    trace_event("i", "tls", "send", NULL, "command", command);
+    return;
+}
+
+void trace_starttls_recv(const char *target, const char *line)
+{
+    char copy[MAX_LINE];
+
+    /* the receive buffer is not always NUL terminated */
+    (void) target;
+    snprintf(copy, sizeof(copy), "%.*s", MAX_LINE - 1, line);
+    trace_event("i", "tls", "recv", NULL, "line", copy);
+    return;
+}
+
+void trace_handshake_start(const char *target, const char *address)
+{
+    (void) target; (void) address;
+    trace_phase_end();
+    trace_phase_begin("handshake");
+    return;
+}
+
+void trace_handshake_end(const char *target, const char *address, int rc)
+{
+    (void) target; (void) address; (void) rc;
+    trace_phase_end();
+    return;
+}
+
+void trace_verdict(const char *target, const char *address,
+		   int authenticated, const char *error)
+{
+    (void) target;
+    trace_phase_end();
+    trace_event("i", "tls", authenticated ? "authenticated" : "failed",
+		NULL, "error", error ? error : "-");
+    if (peer_open) {
+	trace_event("E", "tls", address, NULL, NULL, NULL);
+	peer_open = 0;
+    }
+    return;
+}
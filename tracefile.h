@@ -0,0 +1,28 @@
+#ifndef __TRACEFILE_H__
+#define __TRACEFILE_H__
+
+#include <stdio.h>
+
+/*
+ * Trace file: per-target timelines in the Chrome trace event (JSON
+ * array) format, viewable in chrome://tracing or Perfetto. Events are
+ * emitted from the tracepoints in trace.h while trace_fp is open.
+ */
+
+extern FILE *trace_fp;
+
+int trace_open(const char *path, const char *hostname, double sample);
+void trace_close(void);
+
+void trace_dns_submit(const char *qname, int qtype);
+void trace_dns_complete(const char *qname, int qtype, int answered);
+void trace_connect_start(const char *target, const char *address);
+void trace_connect_end(const char *target, const char *address, int rc);
+void trace_starttls_send(const char *target, const char *command);
+void trace_starttls_recv(const char *target, const char *line);
+void trace_handshake_start(const char *target, const char *address);
+void trace_handshake_end(const char *target, const char *address, int rc);
+void trace_verdict(const char *target, const char *address,
+		   int authenticated, const char *error);
+
+#endif /* __TRACEFILE_H__ */
@@ -2,7 +2,16 @@
  * utils.c
  */
 
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
 #include "utils.h"
+#include "common.h"
 
 /*
  * bin2hexstring(): convert binary input into a string of hex digits.
@@ -23,11 +32,155 @@ char *bin2hexstring(uint8_t *data, size_t length)
 }
 
 /*
- * bindata2hexstring(): convert a getdns bindata input into a string of
- * hex digits. Caller needs to free returned memory.
+ * now_usec(): monotonic clock reading in microseconds, for measuring
+ * elapsed times.
+ */
+
+uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * same_domain_name(): compare two domain names in presentation format,
+ * ignoring case and a trailing dot. Returns 1 if they are equal.
+ */
+
+int same_domain_name(const char *a, const char *b)
+{
+    size_t alen = strlen(a), blen = strlen(b);
+
+    if (alen > 0 && a[alen-1] == '.')
+	alen--;
+    if (blen > 0 && b[blen-1] == '.')
+	blen--;
+    return (alen == blen && strncasecmp(a, b, alen) == 0);
+}
+
+
+/*
+ * sample_random(): small deterministic PRNG (xorshift32), so that a
+ * given --seed selects the same sample on every platform.
  */
 
-char *bindata2hexstring(getdns_bindata *b)
+uint32_t sample_random(uint32_t *state)
 {
-    return bin2hexstring(b->data, b->size);
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+
+/*
+ * skip_address(): report an address dropped by select_addresses()
+ * and free it.
+ */
+
+void skip_address(struct addrinfo *aip)
+{
+    char ipstring[INET6_ADDRSTRLEN];
+
+    if (aip->ai_family == AF_INET6)
+	inet_ntop(AF_INET6, &((struct sockaddr_in6 *) aip->ai_addr)->sin6_addr,
+		  ipstring, sizeof(ipstring));
+    else
+	inet_ntop(AF_INET, &((struct sockaddr_in *) aip->ai_addr)->sin_addr,
+		  ipstring, sizeof(ipstring));
+    fprintf(stdout, "Skipping IPv%d address: %s (not selected)\n",
+	    aip->ai_family == AF_INET6 ? 6 : 4, ipstring);
+
+    aip->ai_next = NULL;
+    freeaddrinfo(aip);
+    return;
+}
+
+
+/*
+ * select_addresses(): apply the address selection policy to the list
+ * of addresses to be checked: restrict to one address family, keep
+ * only the first address of each family, and/or keep a random sample
+ * of sample_count addresses (chosen with sample_seed). Addresses that
+ * are kept stay in their original order; the others are reported and
+ * freed. Returns the new head of the list.
+ */
+
+struct addrinfo *select_addresses(struct addrinfo *addresses)
+{
+    struct addrinfo *aip, *next, *head = NULL, *tail = NULL;
+    struct addrinfo **candidates;
+    int seen_v4 = 0, seen_v6 = 0, keep;
+    size_t i, j, n = 0;
+    uint32_t state;
+    char *selected;
+
+    /* Address family and one-per-family policies */
+    for (aip = addresses; aip != NULL; aip = next) {
+	next = aip->ai_next;
+	keep = 1;
+	if (address_family != AF_UNSPEC && aip->ai_family != address_family)
+	    keep = 0;
+	else if (one_per_family) {
+	    if (aip->ai_family == AF_INET6)
+		keep = !seen_v6++;
+	    else
+		keep = !seen_v4++;
+	}
+	if (!keep) {
+	    skip_address(aip);
+	    continue;
+	}
+	aip->ai_next = NULL;
+	if (tail == NULL)
+	    head = aip;
+	else
+	    tail->ai_next = aip;
+	tail = aip;
+	n++;
+    }
+
+    if (sample_count <= 0 || n <= (size_t) sample_count)
+	return head;
+
+    /* Random sample: partial Fisher-Yates shuffle over list positions */
+    candidates = (struct addrinfo **) malloc(n * sizeof(struct addrinfo *));
+    selected = (char *) calloc(n, 1);
+    for (i = 0, aip = head; aip != NULL; aip = aip->ai_next)
+	candidates[i++] = aip;
+    state = sample_seed ? sample_seed : 1;
+    for (i = 0; i < (size_t) sample_count; i++) {
+	j = i + sample_random(&state) % (n - i);
+	aip = candidates[i];
+	candidates[i] = candidates[j];
+	candidates[j] = aip;
+    }
+    for (i = 0; i < (size_t) sample_count; i++) {
+	for (j = 0, aip = head; aip != candidates[i]; aip = aip->ai_next)
+	    j++;
+	selected[j] = 1;
+    }
+
+    for (i = 0, aip = head, head = tail = NULL; aip != NULL; aip = next, i++) {
+	next = aip->ai_next;
+	if (!selected[i]) {
+	    skip_address(aip);
+	    continue;
+	}
+	aip->ai_next = NULL;
+	if (tail == NULL)
+	    head = aip;
+	else
+	    tail->ai_next = aip;
+	tail = aip;
+    }
+
+    free(candidates);
+    free(selected);
+    return head;
 }
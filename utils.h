@@ -4,11 +4,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <getdns/getdns.h>
-#include <getdns/getdns_extra.h>
+#include <netdb.h>
 
 char *bin2hexstring(uint8_t *data, size_t length);
-char *bindata2hexstring(getdns_bindata *b);
+uint64_t now_usec(void);
+int same_domain_name(const char *a, const char *b);
+struct addrinfo *select_addresses(struct addrinfo *addresses);
 
 #endif /* __UTILS_H__ */
 